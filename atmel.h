@@ -1,5 +1,11 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#ifndef HOST_SIM
+#include <avr/sleep.h>
+#endif
 #include "byte_manipulation.h"
 #include "esc_config.h"
+#include "ticks24.h"
 ////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Attempt to isolate chip level actions here, with the dream being to swap this file with arm.h, and //
 // the code then compiles for arm.  Currently for a fixed esc_config, but will likely be split into	      //
@@ -25,10 +31,46 @@ constexpr inline uint8_t T0CLK = 1U << CS01; // CLK/8 == 2 MHZ.
 // input capture register (ICR1), which can then be used in the ISR to measure the prior/next pulse.
 // EX: Clear TCNT1 on the rising edge, and then measure on the known to be coming falling edge.
 constexpr inline uint8_t T1CLK = 0xC1u;
+// RC_PULS or DSHOT: TIMER1_CAPT_vect reads the RC input on ICP1. Not TWI_SLAVE, which has no
+// capture ISR: an edge on the idle ICP1 pin would land in __bad_interrupt and reset the chip.
+constexpr inline uint8_t RC_INPUT_INTERRUPT_ENABLE = (RC_PULS || DSHOT) ? (1U<<TICIE1) : 0x00u;
+#if TIMER2_COMPARE_PWM
+// Fast PWM (WGM21 and WGM20), OC2 disconnected, (CLK/8) 2 MHZ, so a period is 256 * 8 cycles.
+constexpr inline uint8_t T2CLK = (1U << WGM21) | (1U << WGM20) | (1U << CS21);
+constexpr inline uint8_t TIMER_INTERRUPTS_ENABLE =  (1U<<TOIE1) | (1U<<OCIE1A) | (1U<<TOIE2) | (1U<<OCIE2)
+    | RC_INPUT_INTERRUPT_ENABLE;
+#else
 constexpr inline uint8_t T2CLK = 1U << CS20; // (CLK/1) 16 MHZ
-constexpr inline uint8_t TIMER_INTERRUPTS_ENABLE =  (1U<<TOIE1) | (1U<<OCIE1A) | (1U<<TOIE2);
+constexpr inline uint8_t TIMER_INTERRUPTS_ENABLE =  (1U<<TOIE1) | (1U<<OCIE1A) | (1U<<TOIE2)
+    | RC_INPUT_INTERRUPT_ENABLE;
+#endif
 constexpr inline uint8_t UNSIGNED_ZERO = 0b00000000;
 
+/////////////////////////////////////////////////////////////////////////
+// Hot flags: bools shared with the ISRs, kept in bits of a bit	       //
+// addressable I/O register rather than SRAM, so reads and writes are  //
+// a single sbis/sbic/sbi/cbi (and atomic), in place of lds/sts.       //
+// The ATmega8 has no GPIOR, so this borrows EEDR (I/O 0x1D), which is //
+// plain storage unless an EEPROM write is started. Nothing here	       //
+// touches the EEPROM, anything that does must save and restore it.    //
+/////////////////////////////////////////////////////////////////////////
+#define HOT_FLAGS EEDR
+
+template <uint8_t BIT>
+struct IoFlag {
+    operator bool() const {
+	return (HOT_FLAGS & getByteWithBitSet(BIT)) != 0x00u;
+    }
+    const IoFlag& operator=(const bool value) const {
+	if (value) {
+	    HOT_FLAGS = HOT_FLAGS | getByteWithBitSet(BIT);
+	} else {
+	    HOT_FLAGS = HOT_FLAGS & getByteWithBitCleared(BIT);
+	}
+	return *this;
+    }
+};
+
 
 inline void zeroTCNT0() {
     TCNT0 = 0x00U;
@@ -41,6 +83,75 @@ inline uint8_t getTCNT0() {
     return TCNT0;
 }
 
+/////////////////////////////////////////////////////////////////////////
+// Timer1: Commutation timing.					       //
+// TCNT1 only has 16 bits, tcnt1x (globals.h) is the 3rd byte, which   //
+// TIMER1_OVF_vect increments. Callers that combine the two also need  //
+// TIFR, to spot an overflow that's pending but not yet serviced.      //
+/////////////////////////////////////////////////////////////////////////
+inline uint16_t getTCNT1() {
+    return TCNT1;
+}
+
+inline void setOCR1A(const uint16_t compare) {
+    OCR1A = compare;
+}
+
+inline void clearPendingOcf1a() {
+    TIFR = getByteWithBitSet(OCF1A);
+}
+
+inline uint8_t getTIFR() {
+    return TIFR;
+}
+
+inline uint8_t getTIMSK() {
+    return TIMSK;
+}
+
+inline void setTIMSK(const uint8_t timsk) {
+    TIMSK = timsk;
+}
+
+// tcnt1 + x as 24 bits, given a TIFR read together with them (interrupts or TOIE1 off).
+// A pending overflow is only counted if TCNT1 was read after it, i.e. still in its lower half.
+inline ticks24_t extendTCNT1(const uint16_t tcnt1, uint8_t x, const uint8_t tifr) {
+    if (get_high(tcnt1) < 0x80u && (tifr & getByteWithBitSet(TOV1)) != 0x00u) {
+	++x;
+    }
+    return ticks24_t(tcnt1, x);
+}
+
+// Timer2: PWM. L byte of the software 16 bit PWM timer, tcnt2h is the H byte.
+inline void setTCNT2(const uint8_t tcnt2) {
+    TCNT2 = tcnt2;
+}
+
+// Busy wait loops which don't otherwise touch a register call this each iteration.
+// Nothing to do on the chip, the host simulation (host/) advances its clock here,
+// otherwise it could never deliver the interrupt the loop is waiting on.
+inline void busyWaitPoll() {
+#ifdef HOST_SIM
+    sim::poll();
+#endif
+}
+
+// Sleep in idle mode, timers running, until the next interrupt. Call with interrupts
+// disabled, after checking whatever is being waited on. Returns with them enabled.
+// sei holds interrupts off for one more instruction, so one already due still wakes the sleep.
+inline void sleepIdleUntilInterrupt() {
+#ifdef HOST_SIM
+    sei();
+    sim::poll();
+#else
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    sleep_enable();
+    sei();
+    sleep_cpu();
+    sleep_disable();
+#endif
+}
+
 // We want to do this AFTER beeping!
 inline void enableTimerInterrupts() {
     // Note:  Atmega8 only has TIMSK, while ATMEGA328P and co have TIMSK0/1, which makes
@@ -59,15 +170,127 @@ inline void enablePwmInterrupt() {
 
 }
 
+////////////////////////////////////////////////////////////////////////
+// Debug markers, DEBUG_MARKERS in esc_config.h, for a logic analyzer  //
+// or a VCD trace (host/simavr_bench.cc --vcd). They use the pins the  //
+// afro_nfet leaves free: PB3-PB5 on the ISP header, and PC4/PC5	      //
+// (SDA/SCL) without TWI_SLAVE. Every mark is a single sbi or cbi, and //
+// a class left out of DEBUG_MARKERS compiles away.		      //
+////////////////////////////////////////////////////////////////////////
+// PB3 high from accepting a zero crossing to the commutation, see wait_commutation().
+constexpr inline uint8_t DEBUG_MARK_ZC = 0x01u;
+// PB4 high for half of every electrical revolution, SimonK's sync pin.
+constexpr inline uint8_t DEBUG_MARK_SYNC = 0x02u;
+// PB5 pulses at every commutation.
+constexpr inline uint8_t DEBUG_MARK_COMMUTATION = 0x04u;
+// PB5 pulses at a demag timeout, an extra pulse ahead of that commutation's.
+constexpr inline uint8_t DEBUG_MARK_DEMAG = 0x08u;
+// PC4 high in the PWM interrupt handlers, between their prologue and epilogue.
+constexpr inline uint8_t DEBUG_MARK_PWM_ISR = 0x10u;
+// PC5 high during update_timing().
+constexpr inline uint8_t DEBUG_MARK_UPDATE_TIMING = 0x20u;
+
+constexpr inline uint8_t DEBUG_MARKERS_ON_PORTC = DEBUG_MARK_PWM_ISR | DEBUG_MARK_UPDATE_TIMING;
+static_assert(!TWI_SLAVE || (DEBUG_MARKERS & DEBUG_MARKERS_ON_PORTC) == 0,
+	      "The PWM_ISR and UPDATE_TIMING markers are on SDA/SCL.");
+
+// The marker's pin, on PORTB, or PORTC for DEBUG_MARKERS_ON_PORTC.
+constexpr uint8_t debugMarkerPin(const uint8_t marker) {
+    switch (marker) {
+    case DEBUG_MARK_ZC:
+	return PB3;
+    case DEBUG_MARK_SYNC:
+	return PB4;
+    case DEBUG_MARK_COMMUTATION:
+    case DEBUG_MARK_DEMAG:
+	return PB5;
+    case DEBUG_MARK_PWM_ISR:
+	return PC4;
+    default:
+	return PC5;
+    }
+}
+
+// The output pins of the enabled markers on PORTB (or PORTC).
+constexpr uint8_t debugMarkerPins(const bool portc) {
+    uint8_t pins = 0x00u;
+    for (uint8_t marker = 0x01u; marker != 0x00u; marker <<= 1) {
+	if ((DEBUG_MARKERS & marker) != 0 && ((DEBUG_MARKERS_ON_PORTC & marker) != 0) == portc) {
+	    pins |= getByteWithBitSet(debugMarkerPin(marker));
+	}
+    }
+    return pins;
+}
+
+template <uint8_t MARKER>
+inline void debugMarkerHigh() {
+    if constexpr ((DEBUG_MARKERS & MARKER) == 0) {
+	return;
+    } else if constexpr ((DEBUG_MARKERS_ON_PORTC & MARKER) != 0) {
+	PORTC = PORTC | getByteWithBitSet(debugMarkerPin(MARKER));
+    } else {
+	PORTB = PORTB | getByteWithBitSet(debugMarkerPin(MARKER));
+    }
+}
+
+template <uint8_t MARKER>
+inline void debugMarkerLow() {
+    if constexpr ((DEBUG_MARKERS & MARKER) == 0) {
+	return;
+    } else if constexpr ((DEBUG_MARKERS_ON_PORTC & MARKER) != 0) {
+	PORTC = PORTC & getByteWithBitCleared(debugMarkerPin(MARKER));
+    } else {
+	PORTB = PORTB & getByteWithBitCleared(debugMarkerPin(MARKER));
+    }
+}
+
+inline void flagOn() {
+    debugMarkerHigh<DEBUG_MARK_ZC>();
+}
+inline void flagOff() {
+    debugMarkerLow<DEBUG_MARK_ZC>();
+}
+
+inline void sync_on() {
+    debugMarkerHigh<DEBUG_MARK_SYNC>();
+}
+inline void sync_off() {
+    debugMarkerLow<DEBUG_MARK_SYNC>();
+}
+
+inline void markCommutation() {
+    debugMarkerHigh<DEBUG_MARK_COMMUTATION>();
+    debugMarkerLow<DEBUG_MARK_COMMUTATION>();
+}
+
+inline void markDemagTimeout() {
+    debugMarkerHigh<DEBUG_MARK_DEMAG>();
+    debugMarkerLow<DEBUG_MARK_DEMAG>();
+}
+
+inline void pwmIsrMarkOn() {
+    debugMarkerHigh<DEBUG_MARK_PWM_ISR>();
+}
+inline void pwmIsrMarkOff() {
+    debugMarkerLow<DEBUG_MARK_PWM_ISR>();
+}
+
+inline void updateTimingMarkOn() {
+    debugMarkerHigh<DEBUG_MARK_UPDATE_TIMING>();
+}
+inline void updateTimingMarkOff() {
+    debugMarkerLow<DEBUG_MARK_UPDATE_TIMING>();
+}
+
 inline void setDefaultRegisterValues() {
     ///////////////////////////////////////////////////
     // Set the I/O registers to safe/default values. //
     ///////////////////////////////////////////////////
-    DDRB = 0x06u;
+    DDRB = 0x06u | debugMarkerPins(false);
     PORTB = 0x06u;
 
-    DDRC = 0x00u;
-    PORTC = 0x30u;
+    DDRC = debugMarkerPins(true);
+    PORTC = 0x30u & (uint8_t) ~debugMarkerPins(true);
 
     DDRD = 0x3Eu;
     PORTD = 0x06u;
@@ -79,6 +302,8 @@ inline void setDefaultRegisterValues() {
     TCCR1B = T1CLK; // timer1: communtation timing, RC pulse measurement.
     TCCR2 = 0b00000000; // timer2: PWM, stopped.
 
+    HOT_FLAGS = 0x00u; // All hot flags false.
+
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -91,6 +316,10 @@ inline void setDefaultRegisterValues() {
 ////////////////////////////////////////////////////////////////////////////////
 inline void init_comparator() {
     SFIOR = getByteWithBitSet(ACME) | SFIOR; // Set Analog Comparator Multiplexor Enable
+    if (ZC_CAPTURE) {
+	// Route ACO into Timer1's input capture in place of the ICP1 pin.
+	ACSR = (ACSR & getByteWithBitCleared(ACI)) | getByteWithBitSet(ACIC);
+    }
 
     if ( mux_a_defined && mux_b_defined && mux_c_defined) {
 	// Disable ADC to make sure ACME works. Only happens if mux_a and mux_b and mux_c are defined...
@@ -114,6 +343,61 @@ inline void comp_adc_disable() {
     }
 }
 
+// Analog comparator output, as of the last synchronized sample.
+inline bool isAcoSet() {
+    return ACSR & getByteWithBitSet(ACO);
+}
+
+// Interrupt (ANA_COMP_vect) on the next ACO rising edge, or falling edge, discarding any
+// edge already flagged. ACIE is cleared while ACIS changes, which can itself raise ACI.
+inline void armComparatorInterrupt(const bool rising) {
+    const uint8_t acsr = ACSR & getByteWithBitCleared(ACIE)
+	& getByteWithBitCleared(ACIS1) & getByteWithBitCleared(ACIS0) & getByteWithBitCleared(ACI);
+    ACSR = acsr;
+    const uint8_t mode = getByteWithBitSet(ACIS1) | (rising ? getByteWithBitSet(ACIS0) : 0x00u);
+    ACSR = acsr | mode | getByteWithBitSet(ACI); // Writing ACI clears it.
+    ACSR = acsr | mode | getByteWithBitSet(ACIE);
+}
+
+inline void disarmComparatorInterrupt() {
+    ACSR = ACSR & getByteWithBitCleared(ACIE) & getByteWithBitCleared(ACI);
+}
+
+// Capture the next rising edge, or falling edge, into ICR1, discarding any capture
+// already flagged. Changing ICES1 can itself flag one.
+inline void setCaptureEdge(const bool rising) {
+    if (rising) {
+	TCCR1B = TCCR1B | getByteWithBitSet(ICES1);
+    } else {
+	TCCR1B = TCCR1B & getByteWithBitCleared(ICES1);
+    }
+    TIFR = getByteWithBitSet(ICF1);
+}
+
+inline bool isCaptureEdgeRising() {
+    return TCCR1B & getByteWithBitSet(ICES1);
+}
+
+// Capture (TIMER1_CAPT_vect) every ACO rising edge, or falling edge.
+inline void armCaptureInterrupt(const bool rising) {
+    setCaptureEdge(rising);
+    TIMSK = TIMSK | getByteWithBitSet(TICIE1);
+}
+
+inline void disarmCaptureInterrupt() {
+    TIMSK = TIMSK & getByteWithBitCleared(TICIE1);
+}
+
+inline uint16_t getICR1() {
+    return ICR1;
+}
+
+// ICP1, the RC input pin: PB0 on the ATmega8.
+constexpr inline uint8_t RCP_IN_INDEX = PB0;
+inline bool isRcpInHigh() {
+    return PINB & getByteWithBitSet(RCP_IN_INDEX);
+}
+
 // Set the ADC to compare against phase x.
 inline void set_comp_phase_a() {
     if (mux_a_defined) {
@@ -167,6 +451,8 @@ constexpr inline uint8_t CpFetIdx = 1;
 #define PWM_A_PORT_IN ANFET_PORT
 #define PWM_B_PORT_IN BNFET_PORT
 #define PWM_C_PORT_IN CNFET_PORT
+// The port all three PWM FETs share, see pwm_port_on in globals.h.
+#define PWM_PORT ANFET_PORT
 
 
 // xNFets are active high.
@@ -223,12 +509,43 @@ inline void allNFetsOff() {
     CnFetOff();
 }
 
-// Motor debug output, unimplemented ATM.
-inline void flagOn() {}
-inline void flagOff() {}
+enum Phase : uint8_t { PHASE_A, PHASE_B, PHASE_C, PHASE_NONE };
 
-inline void sync_on() {}
-inline void sync_off() {}
+inline void pFetOn(const uint8_t phase) {
+    switch (phase) {
+    case PHASE_A: ApFetOn(); break;
+    case PHASE_B: BpFetOn(); break;
+    case PHASE_C: CpFetOn(); break;
+    }
+}
+
+inline void pFetOff(const uint8_t phase) {
+    switch (phase) {
+    case PHASE_A: ApFetOff(); break;
+    case PHASE_B: BpFetOff(); break;
+    case PHASE_C: CpFetOff(); break;
+    }
+}
+
+// The phase's pFET bit if that pFET sits on PWM_PORT, else 0.
+inline uint8_t pFetPwmPortBit(const uint8_t phase) {
+    switch (phase) {
+    case PHASE_A: return APFET_ON_PWM_PORT ? getByteWithBitSet(ApFetIdx) : 0;
+    case PHASE_B: return BPFET_ON_PWM_PORT ? getByteWithBitSet(BpFetIdx) : 0;
+    case PHASE_C: return CPFET_ON_PWM_PORT ? getByteWithBitSet(CpFetIdx) : 0;
+    default: return 0;
+    }
+}
+
+// Busy wait exactly CYCLES cpu cycles, for FET dead times too short for _delay_us.
+template <uint32_t CYCLES>
+inline void delayCycles() {
+#ifdef HOST_SIM
+    sim::delay_cycles(CYCLES);
+#else
+    __builtin_avr_delay_cycles(CYCLES);
+#endif
+}
 
 // Disable PWM, clear PWM interrupts, stop PWM switching
 
@@ -237,7 +554,17 @@ inline void disablePWMInterrupts() {
     TCCR2 = UNSIGNED_ZERO; // Disable PWM interrupts;
 }
 inline void clearPendingPwmInterrupts() {
-    TIFR = getByteWithBitSet(TOV2); // Clear pending PWM interrupts
+    if (TIMER2_COMPARE_PWM) {
+	TIFR = getByteWithBitSet(TOV2) | getByteWithBitSet(OCF2); // Clear pending PWM interrupts
+    } else {
+	TIFR = getByteWithBitSet(TOV2); // Clear pending PWM interrupts
+    }
+}
+
+// TIMER2_COMPARE_PWM only: Where in the 256 tick period to switch the FETs off.
+// OCR2 is double buffered in fast PWM mode, so this takes effect at the next period.
+inline void setPwmCompare(const uint8_t compare) {
+    OCR2 = compare;
 }
 
 
@@ -1,22 +1,10 @@
+#include "globals.h"
+#include "atmel.h"
+#include "interrupts.h"
+
 #ifndef COMMUTATIONS_H
 #define COMMUTATIONS_H
 
-struct OrigPortNewPortVal {
-private:
-    const uint8_t orig;
-    const uint8_t new_val;
-public:
-    uint8_t get_orig() const { return orig; }
-    uint8_t get_new() const { return new_val; }
-    OrigPortNewPortVal(const uint8_t orig, const uint8_t new_val) : orig(orig), new_val(new_val) {
-    }
-
-    bool values_equal() const {
-	return get_orig() == get_new();
-    }
-};
-
-
 inline void pwm_all_off() {
     if (HIGH_SIDE_PWM) {
 	allPFetsOff();
@@ -25,63 +13,23 @@ inline void pwm_all_off() {
     }
 }
 
-// These *FOCUS* functions do nothing with comp_pwm disabled
-inline void pwm_focus_c_off() {};
-inline void pwm_focus_c_on() {};
-inline void pwm_focus_b_off() {};
-inline void pwm_focus_b_on() {};
-inline void pwm_focus_a_off() {};
-inline void pwm_focus_a_on() {};
-// END focus function block
-
-// Below: Lots of duplicated pwm control code, duplicated per each FET.
-// TODO(Bregg): Clean up.
-// Skip setting A if we didn't change the port in copy_from.
-// Otherwise, change a.
-inline void pwm_a_copy(const OrigPortNewPortVal copy_from) {
-    if (copy_from.values_equal()) { return; }
-    if ( HIGH_SIDE_PWM ) { ApFetOn(); } else { AnFetOn(); }
-}
-inline void pwm_b_copy(const OrigPortNewPortVal copy_from) {
-    if (copy_from.values_equal()) { return; }
-    if ( HIGH_SIDE_PWM ) { BpFetOn(); } else { BnFetOn(); }
-}
-inline void pwm_c_copy(const OrigPortNewPortVal copy_from) {
-    if (copy_from.values_equal()) { return; }
-    if ( HIGH_SIDE_PWM ) { CpFetOn(); } else { CnFetOn(); }
-}
-
-inline OrigPortNewPortVal pwm_a_clear() {
-    uint8_t orig_port_value = PWM_A_PORT_IN;
-    if ( HIGH_SIDE_PWM ) {
-	ApFetOff();
-    } else {
-	AnFetOff();
-    }
-    uint8_t new_port_value = PWM_A_PORT_IN;
-    return OrigPortNewPortVal(orig_port_value, new_port_value);
-}
-inline OrigPortNewPortVal pwm_b_clear() {
-    uint8_t orig_port_value = PWM_B_PORT_IN;
-    if ( HIGH_SIDE_PWM ) {
-	BpFetOff();
-    } else {
-	BnFetOff();
+// These *FOCUS* functions do nothing with comp_pwm disabled.
+// With COMP_PWM they hand the complementary FET over from the old PWM phase to the new one,
+// with interrupts disabled. The old pFET goes off before the PWM FET moves, and the new one
+// is only switched on by the next PWM off edge, after its dead time.
+inline void pwm_focus_off(const uint8_t phase) {
+    if (COMP_PWM) {
+	comp_fet = PHASE_NONE;
+	pFetOff(phase);
     }
-    uint8_t new_port_value = PWM_B_PORT_IN;
-    return OrigPortNewPortVal(orig_port_value, new_port_value);
 }
 
-inline OrigPortNewPortVal pwm_c_clear() {
-    uint8_t orig_port_value = PWM_C_PORT_IN;
-    if ( HIGH_SIDE_PWM ) {
-	CpFetOff();
-    } else {
-	CnFetOff();
+inline void pwm_focus_on(const uint8_t phase) {
+    if (COMP_PWM && power_on) {
+	comp_fet = phase;
     }
-    uint8_t new_port_value = PWM_C_PORT_IN;
-    return OrigPortNewPortVal(orig_port_value, new_port_value);
 }
+// END focus function block
 
 // Commutation drive macros. All this duplicated code will be cleaned one day...
 inline void commutate_a_off() {
@@ -108,73 +56,124 @@ inline void commutate_c_on() {
     if ( HIGH_SIDE_PWM ) { CnFetOn(); } else { CpFetOn(); }
 }
 
-inline void all_fets_false() {
-    a_fet = false;
-    b_fet = false;
-    c_fet = false;
+inline void commutate_on(const uint8_t phase) {
+    switch (phase) {
+    case PHASE_A: commutate_a_on(); break;
+    case PHASE_B: commutate_b_on(); break;
+    default: commutate_c_on(); break;
+    }
 }
 
-// An on, Cn off
-inline void com1com6() {
-    set_comp_phase_c();
-    cli();
-    all_fets_false();
-    a_fet = true;
-    pwm_focus_c_off();
-    pwm_a_copy(pwm_c_clear());
-    pwm_focus_a_on();
-    sei();
+inline void commutate_off(const uint8_t phase) {
+    switch (phase) {
+    case PHASE_A: commutate_a_off(); break;
+    case PHASE_B: commutate_b_off(); break;
+    default: commutate_c_off(); break;
+    }
 }
 
-// Cp on, Bp off.
-inline void com6com5() {
-    set_comp_phase_b();
-    commutate_b_off();
-    if (power_on) {
-	commutate_c_on();
+inline uint8_t pwm_fet_bit_of(const uint8_t phase) {
+    switch (phase) {
+    case PHASE_A: return getByteWithBitSet(AnFetIdx);
+    case PHASE_B: return getByteWithBitSet(BnFetIdx);
+    default: return getByteWithBitSet(CnFetIdx);
     }
+}
 
+inline void set_comp_phase(const uint8_t phase) {
+    switch (phase) {
+    case PHASE_A: set_comp_phase_a(); break;
+    case PHASE_B: set_comp_phase_b(); break;
+    default: set_comp_phase_c(); break;
+    }
 }
-// Bn on, An off
-inline void com5com4() {
-    set_comp_phase_a();
-    cli();
-    all_fets_false();
-    b_fet = true;
-    pwm_focus_a_off();
-    pwm_b_copy(pwm_a_clear());
-    pwm_focus_b_on();
-    sei();
+
+//////////////////////////////////////////////////////////////////////////////
+// Commutation tables. Each step waits for the floating phase's zero	    //
+// crossing edge, points the comparator at the next floating phase, and    //
+// moves one side of the drive from phase off to phase on: the PWM (low    //
+// side) FET, or the commutated (high side) FET if power_on.		    //
+// Both tables start from step 1 (Bp and Cn on) and walk the 6 steps in    //
+// opposite orders, so the direction can change at arming. They are only   //
+// ever indexed with constants (see control.cc), so each step compiles to  //
+// the same straight line code as SimonK's comXcomY macros.		    //
+//////////////////////////////////////////////////////////////////////////////
+enum SyncMark : uint8_t { SYNC_NONE, SYNC_ON, SYNC_OFF };
+
+struct CommutationStep {
+    bool edge_high; // Edge to wait for before the step, wait_for_high or wait_for_low.
+    bool pwm_side; // Moves the PWM FET, else the commutated FET.
+    uint8_t off; // Phase whose FET is switched off.
+    uint8_t on; // Phase whose FET is switched on.
+    uint8_t comparator; // The floating phase after the step.
+    SyncMark sync; // Scope sync output after the step.
+};
+
+constexpr inline uint8_t COMMUTATION_STEPS = 6;
+
+// SimonK's MOTOR_REVERSE order, what SimonKpp has always run.
+constexpr inline CommutationStep REVERSE_STEPS[COMMUTATION_STEPS] = {
+    {false, true, PHASE_C, PHASE_A, PHASE_C, SYNC_ON}, // com1com6: An on, Cn off
+    {true, false, PHASE_B, PHASE_C, PHASE_B, SYNC_NONE}, // com6com5: Cp on, Bp off
+    {false, true, PHASE_A, PHASE_B, PHASE_A, SYNC_NONE}, // com5com4: Bn on, An off
+    {true, false, PHASE_C, PHASE_A, PHASE_C, SYNC_OFF}, // com4com3: Ap on, Cp off
+    {false, true, PHASE_B, PHASE_C, PHASE_B, SYNC_NONE}, // com3com2: Cn on, Bn off
+    {true, false, PHASE_A, PHASE_B, PHASE_A, SYNC_NONE}, // com2com1: Bp on, Ap off
+};
+
+constexpr inline CommutationStep FORWARD_STEPS[COMMUTATION_STEPS] = {
+    {true, false, PHASE_B, PHASE_A, PHASE_B, SYNC_ON}, // com1com2: Ap on, Bp off
+    {false, true, PHASE_C, PHASE_B, PHASE_C, SYNC_NONE}, // com2com3: Bn on, Cn off
+    {true, false, PHASE_A, PHASE_C, PHASE_A, SYNC_NONE}, // com3com4: Cp on, Ap off
+    {false, true, PHASE_B, PHASE_A, PHASE_B, SYNC_OFF}, // com4com5: An on, Bn off
+    {true, false, PHASE_C, PHASE_B, PHASE_C, SYNC_NONE}, // com5com6: Bp on, Cp off
+    {false, true, PHASE_A, PHASE_C, PHASE_A, SYNC_NONE}, // com6com1: Cn on, An off
+};
+
+constexpr CommutationStep commutation_step(const bool reverse, const uint8_t step) {
+    return reverse ? REVERSE_STEPS[step] : FORWARD_STEPS[step];
 }
 
-// Ap on, Cp off
-inline void com4com3() {
-    set_comp_phase_c();
-    commutate_c_off();
-    if (power_on) {
-	commutate_a_on();
+// The PWM FET steps move the PWM with move_pwm_fet(), the others resync the
+// PWM port images as Ap shares PWM_PORT with the nFETs. See interrupts.h.
+// Interrupts must be disabled.
+inline void commutate_fets(const CommutationStep step) {
+    if (step.pwm_side) {
+	pwm_focus_off(step.off);
+	move_pwm_fet(pwm_fet_bit_of(step.on));
+	pwm_focus_on(step.on);
+    } else {
+	commutate_off(step.off);
+	if (power_on) {
+	    commutate_on(step.on);
+	}
+	sync_pwm_port();
     }
+}
 
+inline void commutate_sync(const CommutationStep step) {
+    if (step.sync == SYNC_ON) {
+	sync_on();
+    } else if (step.sync == SYNC_OFF) {
+	sync_off();
+    }
 }
-// Cn on, Bn off
-inline void com3com2() {
-    set_comp_phase_b();
+
+inline void commutate(const CommutationStep step) {
+    set_comp_phase(step.comparator);
     cli();
-    all_fets_false();
-    c_fet = true;
-    pwm_focus_b_off();
-    pwm_c_copy(pwm_b_clear());
-    pwm_focus_c_on();
+    commutate_fets(step);
     sei();
+    markCommutation();
+    commutate_sync(step);
 }
 
-// Bp on, Ap off
-inline void com2com1() {
-    set_comp_phase_a();
-    commutate_a_off();
-    if ( power_on ) {
-	commutate_b_on();
-    }
+// commutate() for TIMER1_COMPA_vect, interrupts stay disabled throughout.
+inline void commutate_locked(const CommutationStep step) {
+    set_comp_phase(step.comparator);
+    commutate_fets(step);
+    markCommutation();
+    commutate_sync(step);
 }
 
 
@@ -12,19 +12,43 @@
 #include "wait_functions.h"
 #include "commutations.h"
 #include "interrupts.h"
+#include "stack.h"
+#include "telemetry.h"
+#include "trace.h"
+#include "perf_counters.h"
+#include "governor.h"
 
-void start_failed() {
-    // TODO: This better,
-    // we probably should have a way to return to the control loop after a failed start after all.
-    // Perhaps wait until we receive a no throttle command and then return up to the arming loop somehow?
-    while(true) {
-	redLedOff();
-	greenLedOn();
-	_delay_ms(2000);
-	redLedOn();
-	greenLedOff();
-	_delay_ms(2000);
+// _delay_ms(MS), still sending telemetry. _delay_ms() wants a constant, so UART_TELEMETRY
+// waits 1ms at a time.
+template <uint16_t MS>
+void delay_ms_telemetry() {
+    if (!UART_TELEMETRY) {
+	_delay_ms(MS);
+	return;
     }
+    for (uint16_t ms = 0; ms < MS; ++ms) {
+	_delay_ms(1);
+	send_telemetry_if_due();
+    }
+}
+
+// One blink of CONTROL_FAILED.
+// TODO: Go back to CONTROL_ARMING once we receive a no throttle command.
+ControlState start_failed() {
+    redLedOff();
+    greenLedOn();
+    delay_ms_telemetry<2000>();
+    redLedOn();
+    greenLedOff();
+    delay_ms_telemetry<2000>();
+    return CONTROL_FAILED;
+}
+
+// Set by request_rearm(), checked after every wait_for_edge().
+bool rearm_requested = false;
+
+void request_rearm() {
+    rearm_requested = true;
 }
 
 // If sys_control_copy is less than or equal to the currently determined
@@ -58,49 +82,76 @@ void run6_2(uint16_t sys_control_copy) {
     return;
 }
 
+// COMMUTATE_IN_ISR: one step, as TIMER1_COMPA_vect runs it.
+template <bool REVERSE, uint8_t STEP>
+void commutate_locked_step() {
+    commutate_locked(commutation_step(REVERSE, STEP));
+}
+
+// One pass through the 6 commutation steps, unrolled at compile time so each
+// step's phases and edge fold into constants.
+// Returns false, without commutating, if the wait requested a rearm.
+template <bool REVERSE, uint8_t STEP = 0>
+inline bool run_commutation_steps() {
+    constexpr CommutationStep step = commutation_step(REVERSE, STEP);
+    aco_edge_high = step.edge_high;
+    if (COMMUTATE_IN_ISR) {
+	// wait_commutation() hands it to TIMER1_COMPA_vect.
+	next_commutation = &commutate_locked_step<REVERSE, STEP>;
+	wait_for_edge();
+    } else {
+	wait_for_edge();
+	if (rearm_requested) {
+	    return false;
+	}
+	commutate(step);
+    }
+    if constexpr (STEP + 1 < COMMUTATION_STEPS) {
+	return !rearm_requested && run_commutation_steps<REVERSE, STEP + 1>();
+    }
+    return !rearm_requested;
+}
+
 //  See run1 in simonk source.
-// TODO: Rename this to run, place the wait_for_low() ... com2com1()
-// under a bool reverse and add the run_forward function in also!
-void run_reverse() {
+// CONTROL_RUNNING, returns the state to go to next.
+template <bool REVERSE>
+ControlState run() {
     while ( true ) {
-	wait_for_low();
-	com1com6();
-	sync_on();
-	wait_for_high();
-	com6com5();
-	wait_for_low();
-	com5com4();
-	wait_for_high();
-	com4com3();
-	sync_off();
-	wait_for_low();
-	com3com2();
-	wait_for_high();
-	com2com1();
+	if (!run_commutation_steps<REVERSE>()) {
+	    return CONTROL_ARMING;
+	}
+	// Once per electrical revolution, between the last commutation and the next zero
+	// crossing wait.
+	if (UART_TELEMETRY) {
+	    send_telemetry_if_due();
+	}
     ///////////
     // run6: //
     ///////////
 	// IF last commutation timed out and power is off, return to restart control
 	if (!power_on && goodies == 0) {
-	    // TODO: Risk of stack overflow here eventually if we restart control enough?!
-	    // Eventually does it make sense to just make restartControl a loop perhaps?
-	    // Can we replace this with a break perhaps?
-	    //
+	    if (COMMUTATION_TRACE) {
+		freeze_trace();
+	    }
 	    // Trap here for 4 seconds so it's very noticable when we fail to start.
-	    _delay_ms(4000);
-	    restart_control();
-	    return;
+	    control_state = CONTROL_FAILED;
+	    delay_ms_telemetry<4000>();
+	    return CONTROL_ARMING;
 	}
 	// Each time TIMING_MAX is hit, sys_control is lsr'd
 	// If zero, try startin over with powerskipping.
 	// yl/yh.
 	uint16_t sys_control_copy = sys_control;
 	if (sys_control_copy == 0) {
-	    start_from_running();
-	    return;
+	    return CONTROL_RECOVERY;
 	}
 
 	if ( ENOUGH_GOODIES <= goodies ) {
+	    // Only once running, timing is a clamp or a guess while starting.
+	    perf_track_timing(timing);
+	    if (RPM_GOVERNOR) {
+		governor_update();
+	    }
 	    // temp1 = goodies, yl/yh sys_control
 	    run6_2(sys_control_copy);
 	    // Loops again at run1.
@@ -119,8 +170,8 @@ void run_reverse() {
 	if (start_modulate == 0) {
 	    // If we've been trying for a long while, give up.
 	    if ( (start_fail + START_FAIL_INC) == 0) {
-		start_failed();
-		return;
+		perf_count(perf_counters.start_failures);
+		return CONTROL_FAILED;
 	    } else {
 		start_fail += START_FAIL_INC;
 	    }
@@ -142,16 +193,28 @@ void run_reverse() {
     }
 }
 
-void start_from_running() {
-    // Not quite where we run rc_duty_set normally,
-    // but should be fine to drop it in here for now!
-    rc_duty_set(MAX_POWER/16);
+// CONTROL_STARTUP and CONTROL_RECOVERY.
+ControlState start_from_running() {
+    if (PERF_COUNTERS) {
+	perf_start_run();
+    }
+    if (RC_PULS) {
+	lock_rc_protocol();
+    }
+    if (!RC_INPUT) {
+	// Not quite where we run rc_duty_set normally,
+	// but should be fine to drop it in here for now!
+	rc_duty_set(MAX_POWER/16);
+    }
     switchPowerOff();
     init_comparator();
     greenLedOff();
     redLedOff();
 
     sys_control = PWR_MIN_START;
+    if (RPM_GOVERNOR) {
+	governor_start();
+    }
     set_duty = true;
     wait_timeout_init();
 
@@ -167,23 +230,107 @@ void start_from_running() {
     start_delay = 0;
     start_modulate = 0;
     start_fail  = 0;
+    if (COMMUTATION_TRACE) {
+	thaw_trace();
+    }
     rc_timeout = RCP_TOT;
     power_skip = 6U;
     goodies = ENOUGH_GOODIES;
     enablePwmInterrupt();
-    run_reverse();
+    return CONTROL_RUNNING;
+}
+
+// RC_INPUT: SimonK's wait_for_power_off/on. Arm only after RCP_TOT valid pulses (or DShot
+// frames) in a row at zero throttle, in one protocol, then start on the first non zero
+// throttle. While set_duty is off,
+// rc_duty_set() counts the pulses in rc_timeout, and TIMER1_OVF_vect counts it back down
+// without them.
+void wait_for_power_on() {
+    while (true) {
+	rc_timeout = 0;
+	while (rc_timeout < RCP_TOT) {
+	    eval_rc_if_pending();
+	    if (UART_TELEMETRY) {
+		send_telemetry_if_due();
+	    }
+	    if (rc_duty != 0) {
+		rc_timeout = 0;
+	    }
+	}
+	const RcProtocol armed_protocol = rc_protocol;
+	while (rc_duty == 0 && rc_timeout != 0) {
+	    eval_rc_if_pending();
+	    if (UART_TELEMETRY) {
+		send_telemetry_if_due();
+	    }
+	}
+	if (rc_timeout != 0 && rc_protocol == armed_protocol) {
+	    return;
+	}
+	// Lost the signal, or it changed protocol, while armed.
+    }
 }
 
-// Also encapsulates wait_for_power_*
-void restart_control() {
+// CONTROL_ARMING. Also encapsulates wait_for_power_*
+ControlState restart_control() {
     switchPowerOff();
     set_duty = false;
-    rc_duty_set(MAX_POWER/16);
+    rc_duty_set(RC_INPUT ? 0 : MAX_POWER/16);
     greenLedOn();
     redLedOff();
+    // Only change direction while stopped, not on a restart from running.
+    motor_reverse = reverse_requested;
     // Idle beeping happened here in simonk.
     // dib_l/h set here (although not rc_duty?).
     // YL/rc_duty is set however, which seems to correspond to power?
-    // After a bunch of puls input validation yadda yadda, we get to start_from_running
-    start_from_running();
+    rearm_requested = false;
+    if (RC_PULS) {
+	open_rc_protocol_detection();
+    }
+    if (RC_INPUT) {
+	wait_for_power_on();
+    }
+    return CONTROL_STARTUP;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Every state runs to completion and returns the next one to this    //
+// loop, so the stack never grows past one state plus its wait_*      //
+// chain. SimonK jumps between these with rjmp, which a C++ call      //
+// can't do without stacking a frame per restart.		      //
+////////////////////////////////////////////////////////////////////////
+void control_loop() {
+    ControlState state = CONTROL_ARMING;
+    while (true) {
+	// Not on the way into CONTROL_RUNNING, the motor is turning then. A run ends in
+	// CONTROL_ARMING or CONTROL_FAILED, and the paint still shows how deep it went.
+	if (state == CONTROL_ARMING || state == CONTROL_FAILED) {
+	    update_stack_watermark();
+	}
+	control_state = state;
+	if (UART_TELEMETRY) {
+	    send_telemetry_if_due();
+	}
+	switch (state) {
+	case CONTROL_ARMING:
+	    state = restart_control();
+	    break;
+	case CONTROL_STARTUP:
+	case CONTROL_RECOVERY:
+	    state = start_from_running();
+	    break;
+	case CONTROL_RUNNING:
+	    // Only DSHOT can change the direction, see reverse_requested, so the other
+	    // builds don't carry a second unrolled run().
+	    if constexpr (DSHOT) {
+		state = motor_reverse ? run<true>() : run<false>();
+	    } else {
+		state = run<MOTOR_REVERSE>();
+	    }
+	    break;
+	case CONTROL_FAILED:
+	    state = start_failed();
+	    break;
+	}
+    }
 }
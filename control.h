@@ -1,5 +1,21 @@
+#include <stdint.h>
+
 #ifndef CONTROL_H
 #define CONTROL_H
-void start_from_running();
-void restart_control();
+
+enum ControlState : uint8_t {
+    CONTROL_ARMING, // Power off, waiting to start.
+    CONTROL_STARTUP, // Starting, or catching a motor already spinning.
+    CONTROL_RUNNING, // Commutating, see run() in control.cc.
+    CONTROL_RECOVERY, // Timing lost while running, starting over without disarming.
+    CONTROL_FAILED, // Gave up starting, blinking.
+};
+
+// The state control_loop() is in, for status reports.
+inline volatile ControlState control_state = CONTROL_ARMING;
+
+// Never returns.
+void control_loop();
+// Leave CONTROL_RUNNING for CONTROL_ARMING once the current wait_* chain unwinds.
+void request_rearm();
 #endif
@@ -0,0 +1,147 @@
+#include <stdint.h>
+#include "esc_config.h"
+#include "globals.h"
+#include "atmel.h"
+#include "set_duty.h"
+
+#ifndef DSHOT_H
+#define DSHOT_H
+
+////////////////////////////////////////////////////////////////////////////////////////
+// DShot on ICP1 (DSHOT in esc_config.h).					      //
+// A frame is 16 bits, MSB first: an 11 bit throttle, the telemetry request bit, and  //
+// a 4 bit CRC. Every bit starts with a rising edge, and stays high for 3/8 of the    //
+// bit for a 0, or 3/4 for a 1.							      //
+// An edge interrupt per bit can't keep up at 53 (DShot300) or 107 (DShot150) cycles  //
+// a bit, so TIMER1_CAPT_vect takes the first rising edge, and then polls the pin at  //
+// fixed Timer1 offsets from ICR1 for the rest of the frame, with interrupts off.     //
+// That is 53us (DShot300) or 107us (DShot150) per frame, which delays the PWM and    //
+// commutation interrupts by up to that much, see the jitter next to DSHOT.	      //
+// The capture interrupt has to start within 11/16 of a bit of the edge, or the	      //
+// frame is dropped.								      //
+////////////////////////////////////////////////////////////////////////////////////////
+
+constexpr inline uint8_t DSHOT_FRAME_BITS = 16;
+// ICNC1 delays the capture by 4 cycles past the edge the bits are timed from.
+constexpr inline uint8_t ICNC1_DELAY_TICKS = 4;
+// Every bit must still be high here, from bit 1 on, or the frame is misaligned.
+constexpr inline uint8_t DSHOT_FRAMING_SIXTEENTHS = 3;
+// Between the end of a 0 (6/16) and the end of a 1 (12/16).
+constexpr inline uint8_t DSHOT_SAMPLE_SIXTEENTHS = 9;
+// Too late to read bit 0.
+constexpr inline uint8_t DSHOT_LATE_SIXTEENTHS = 11;
+
+// Throttle 1-47 are commands, 48-2047 the throttle range.
+constexpr inline uint16_t DSHOT_MIN_THROTTLE = 48;
+constexpr inline uint16_t DSHOT_THROTTLE_STEPS = 2000;
+// Duty per throttle step, 16.16, so there's no divide per frame.
+constexpr inline uint32_t DSHOT_SCALE = 0x10000ul * MAX_POWER / DSHOT_THROTTLE_STEPS;
+
+// The commands acted on. Betaflight repeats each one, with the telemetry bit set.
+enum DshotCommand : uint8_t {
+    DSHOT_CMD_SPIN_DIRECTION_1 = 7,
+    DSHOT_CMD_SPIN_DIRECTION_2 = 8,
+    DSHOT_CMD_SPIN_DIRECTION_NORMAL = 20,
+    DSHOT_CMD_SPIN_DIRECTION_REVERSED = 21,
+};
+constexpr inline uint8_t DSHOT_COMMAND_REPEATS = 6;
+
+// TIMER1_CAPT_vect only.
+inline uint8_t dshot_command = 0;
+inline uint8_t dshot_command_count = 0;
+
+// Timer1 ticks from the start of the frame to SIXTEENTHS/16 into bit BIT.
+constexpr uint16_t dshot_ticks(const uint8_t bit, const uint8_t sixteenths) {
+    return (bit * 16ul + sixteenths) * cpu_mhz * 1000ul / (16ul * DSHOT);
+}
+
+inline bool dshot_before(const uint16_t start, const uint16_t ticks) {
+    return (uint16_t) (getTCNT1() - start) < ticks;
+}
+
+// Shifts bits BIT to 15 into frame, unrolled at compile time so every offset is a
+// constant. Returns false on a framing error.
+template <uint8_t BIT = 0>
+inline bool dshot_sample_bits(const uint16_t start, uint16_t& frame) {
+    if constexpr (BIT == 0) {
+	// Bit 0's rising edge is the capture itself.
+	if (!dshot_before(start, dshot_ticks(0, DSHOT_LATE_SIXTEENTHS))) {
+	    return false;
+	}
+    } else {
+	while (dshot_before(start, dshot_ticks(BIT, DSHOT_FRAMING_SIXTEENTHS))) {}
+	if (!isRcpInHigh()) {
+	    return false;
+	}
+    }
+    while (dshot_before(start, dshot_ticks(BIT, DSHOT_SAMPLE_SIXTEENTHS))) {}
+    frame = (frame << 1) | isRcpInHigh();
+    if constexpr (BIT + 1 < DSHOT_FRAME_BITS) {
+	return dshot_sample_bits<BIT + 1>(start, frame);
+    }
+    return true;
+}
+
+// CRC of the throttle and telemetry bit, the frame's low nibble.
+constexpr uint8_t dshot_crc(const uint16_t value) {
+    return (value ^ (value >> 4) ^ (value >> 8)) & 0x0Fu;
+}
+
+constexpr uint16_t dshot_duty(const uint16_t throttle) {
+    return ((throttle - (DSHOT_MIN_THROTTLE - 1)) * DSHOT_SCALE) >> 16;
+}
+
+// Only while stopped, and once repeated DSHOT_COMMAND_REPEATS times in a row.
+// The direction is latched at the next arming, like reverse_requested always is.
+inline void dshot_run_command(const uint8_t command, const bool telemetry) {
+    if (!telemetry || set_duty) {
+	dshot_command_count = 0;
+	return;
+    }
+    if (command != dshot_command) {
+	dshot_command = command;
+	dshot_command_count = 0;
+    }
+    if (++dshot_command_count != DSHOT_COMMAND_REPEATS) {
+	return;
+    }
+    switch (command) {
+    case DSHOT_CMD_SPIN_DIRECTION_1:
+    case DSHOT_CMD_SPIN_DIRECTION_NORMAL:
+	reverse_requested = MOTOR_REVERSE;
+	break;
+    case DSHOT_CMD_SPIN_DIRECTION_2:
+    case DSHOT_CMD_SPIN_DIRECTION_REVERSED:
+	reverse_requested = !MOTOR_REVERSE;
+	break;
+    default:
+	break;
+    }
+}
+
+// From TIMER1_CAPT_vect, at the first rising edge of a frame. A frame failing the
+// framing or CRC checks is dropped without touching the throttle. Throttle 0 is stop,
+// which disarms like a zero RC pulse does.
+inline void dshot_receive_frame(const uint16_t icr1) {
+    const uint16_t start = icr1 - ICNC1_DELAY_TICKS;
+    uint16_t frame = 0;
+    const bool framed = dshot_sample_bits(start, frame);
+    // Bits 1-15 flagged captures of their own.
+    setCaptureEdge(true);
+    const uint16_t value = frame >> 4;
+    if (!framed || dshot_crc(value) != (frame & 0x0Fu)) {
+	return;
+    }
+    const uint16_t throttle = value >> 1;
+    if (throttle >= DSHOT_MIN_THROTTLE) {
+	dshot_command_count = 0;
+	post_rc_duty(dshot_duty(throttle));
+    } else if (throttle == 0) {
+	dshot_command_count = 0;
+	post_rc_duty(0);
+    } else {
+	dshot_run_command(throttle, value & 0x01u);
+    }
+}
+
+#endif
@@ -0,0 +1,44 @@
+#include "duty_limit.h"
+
+#include <avr/pgmspace.h>
+
+static_assert(DUTY_LIMIT_DIVIDEND % 1024 == 0 && (DUTY_LIMIT_DIVIDEND >> 10) < 0x10000,
+	      "The first estimate multiplies DUTY_LIMIT_DIVIDEND / 1024 by 16 bits in 32.");
+
+// Entry m - 128 is 2^23 / (m + 0.5), rounded, for the leading timing bits m = 128..255.
+struct ReciprocalTable {
+    uint16_t entries[128];
+};
+
+constexpr ReciprocalTable make_reciprocal_table() {
+    ReciprocalTable table{};
+    for (uint16_t i = 0; i < 128; ++i) {
+	const uint32_t twice_m_plus_half = 2 * (128 + i) + 1;
+	table.entries[i] = (0x2000000ul + twice_m_plus_half) / (2 * twice_m_plus_half);
+    }
+    return table;
+}
+
+const ReciprocalTable reciprocal_table PROGMEM = make_reciprocal_table();
+
+uint16_t low_speed_duty_limit(const ticks24_t timing) {
+    if (timing > DUTY_LIMIT_MAX_TIMING) {
+	return PWR_MAX_RPM1;
+    }
+    uint8_t shift = 8;
+    uint16_t leading = timing.high16();
+    while (leading > 0xFFu) {
+	leading >>= 1;
+	++shift;
+    }
+    const uint16_t reciprocal = pgm_read_word(&reciprocal_table.entries[leading - 128]);
+    // Within 1/256 of the quotient, since the table ignores the bits below the leading 8.
+    uint16_t duty = ((DUTY_LIMIT_DIVIDEND >> 10) * reciprocal) >> (13 + shift);
+    // Add remainder / timing, using the same reciprocal.
+    const int32_t remainder = DUTY_LIMIT_DIVIDEND - (uint32_t) duty * timing.widen();
+    duty += ((remainder >> shift) * reciprocal) >> 23;
+    if (PWR_MAX_RPM1 > duty) {
+	duty = PWR_MAX_RPM1;
+    }
+    return duty;
+}
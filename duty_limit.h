@@ -0,0 +1,25 @@
+#include <stdint.h>
+#include "globals.h"
+#include "ticks24.h"
+
+#ifndef DUTY_LIMIT_H
+#define DUTY_LIMIT_H
+
+////////////////////////////////////////////////////////////////////////////
+// Low speed duty limit, MAX_POWER * (TIMING_RANGE3 * cpu_mhz/2) / timing, //
+// no lower than PWR_MAX_RPM1.						  //
+// SimonK does this with a 24 bit shift/subtract divide (33 rounds).	  //
+// Here the 8 leading bits of the timing index a flash table of		  //
+// reciprocals, and one multiply on the remainder refines the quotient.	  //
+// Matches the divide to -1/+0 (0.06% of MAX_POWER) for every timing	  //
+// from TIMING_RANGE3 * cpu_mhz/2 up, and exactly once clamped, which	  //
+// make host-check tries for every one of them.				  //
+////////////////////////////////////////////////////////////////////////////
+constexpr inline ticks24_t DUTY_LIMIT_MIN_TIMING = ticks24_t::wrap(TIMING_RANGE3 * cpu_mhz / 2);
+constexpr inline uint32_t DUTY_LIMIT_DIVIDEND = (uint32_t) MAX_POWER * DUTY_LIMIT_MIN_TIMING.widen();
+// Any longer timing is clamped to PWR_MAX_RPM1, no need to divide.
+constexpr inline ticks24_t DUTY_LIMIT_MAX_TIMING = ticks24_t::wrap(DUTY_LIMIT_DIVIDEND / PWR_MAX_RPM1);
+
+// timing must be at least DUTY_LIMIT_MIN_TIMING, so it has 8 leading bits past bit 7.
+uint16_t low_speed_duty_limit(const ticks24_t timing);
+#endif
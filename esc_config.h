@@ -10,6 +10,10 @@
 #define APFET_PORT PORTD
 #define BPFET_PORT PORTB
 #define CPFET_PORT PORTB
+// Which pFETs share a port with the nFETs (PWM_PORT), set to match the ports above.
+constexpr inline bool APFET_ON_PWM_PORT = true;
+constexpr inline bool BPFET_ON_PWM_PORT = false;
+constexpr inline bool CPFET_ON_PWM_PORT = false;
 
 
 
@@ -37,4 +41,147 @@ constexpr inline uint8_t cpu_mhz = 16U;
 constexpr inline bool slow_cpu = true;
 constexpr inline bool SLOW_CPU = slow_cpu;
 
+// PWM engine. 0: Timer2 free runs at CLK/1, and the overflow ISR flips the FETs and reloads
+// TCNT2/tcnt2h on every edge (SimonK).
+// 1: Timer2 runs in fast PWM mode at CLK/8, the overflow ISR switches the FETs on and the
+// compare match ISR switches them off at OCR2, with no reloads and no tcnt2h.
+// That is a 256 * 8 cycle period, 7.8kHz with 256 duty steps, where 0 runs at about
+// 10.3kHz (POWER_RANGE, 1556 cycles) with POWER_RANGE steps. Fast PWM's TOP is fixed at
+// 0xFF on Timer2, and the prescalers next to CLK/8 are CLK/1 (62.5kHz) and CLK/32, so no
+// setting keeps the 0 frequency.
+// The ATmega8 only has the one OC2 pin (PB3), which no FET is wired to on the afro_nfet, so the
+// FETs are still switched from the ISRs, but long off periods no longer cost an extra
+// interrupt every 256 cycles.
+#ifndef TIMER2_COMPARE_PWM
+#define TIMER2_COMPARE_PWM 0
+#endif
+
+// Complementary PWM: switch the PWM phase's pFET on for the PWM off period, so the
+// freewheeling current flows through it instead of the nFET's body diode, see interrupts.h.
+#ifndef COMP_PWM
+#define COMP_PWM 0
+#endif
+
+// COMP_PWM dead time in CPU cycles, between one FET of the PWM phase switching off and the
+// other switching on. The port writes around it add a few more. 8 cycles is 500ns at 16MHz.
+#ifndef DEAD_TIME_CYCLES
+#define DEAD_TIME_CYCLES 8
+#endif
+
+// Zero crossing detection. 0: wait_for_demag() and wait_for_edge2() poll ACO the whole time (SimonK).
+// 1: ANA_COMP_vect timestamps the comparator edge, and the foreground only runs the ZC_CHECK
+// filter once an edge has arrived, see wait_functions.cc.
+#ifndef ZC_INTERRUPT
+#define ZC_INTERRUPT 0
+#endif
+
+// Zero crossing timestamps. 0: Timer1 as read in software once the ZC filter passes, or in
+// ANA_COMP_vect with ZC_INTERRUPT. 1: the comparator drives Timer1's input capture (ACIC), and
+// TIMER1_CAPT_vect extends ICR1 at the last edge into the awaited level. Takes the input
+// capture unit away from the ICP1 pin. With ZC_INTERRUPT, the capture interrupt is the one
+// the wait loops arm, in place of ANA_COMP_vect.
+#ifndef ZC_CAPTURE
+#define ZC_CAPTURE 0
+#endif
+
+// Throttle input. 0: none, the motor runs at a fixed MAX_POWER/16 (bench).
+// 1: RC servo pulses on ICP1, timed in Timer1 ticks (1/16us) by TIMER1_CAPT_vect, and scaled
+// from STOP_RC_PULS..FULL_RC_PULS (globals.h) to the duty by evaluate_rc(). Needs the input
+// capture unit, so not together with ZC_CAPTURE.
+#ifndef RC_PULS
+#define RC_PULS 0
+#endif
+
+// Digital throttle input. 0: off. 150 or 300: DShot150 or DShot300 frames on ICP1, sampled
+// bit by bit from the first edge by TIMER1_CAPT_vect, see dshot.h. Not together with
+// RC_PULS or ZC_CAPTURE.
+// Each frame is read with interrupts off, for about 53us (DShot300) or 107us (DShot150).
+// Worst case jitter, per frame received:
+// - PWM: an edge lands up to that late, over half (DShot300) or more than all (DShot150)
+//   of the ~97us PWM period.
+// - Commutation: the zero crossing poll stalls as long, so the commutation slips by up to
+//   53us/107us: half, or more than all, of the 100us commutation interval at 100k eRPM,
+//   and 6 or 13 degrees at 20k eRPM.
+// So not together with COMMUTATE_IN_ISR or TIMER2_COMPARE_PWM either, which exist to make
+// those two exact.
+#ifndef DSHOT
+#define DSHOT 0
+#endif
+
+// I2C throttle. 0: off. 1: MikroKopter style TWI slave, see twi.h. Not together with
+// RC_PULS or DSHOT.
+#ifndef TWI_SLAVE
+#define TWI_SLAVE 0
+#endif
+
+// TWI_SLAVE: this ESC's number on the bus, 1 to 8, build each ESC with its own
+// (make TWI_MOTOR_ID=n).
+#ifndef TWI_MOTOR_ID
+#define TWI_MOTOR_ID 1
+#endif
+
+// Throttle input. 0: sets the duty (SimonK). 1: sets a target eRPM, which a PI controller
+// holds by setting the duty, see governor.h.
+#ifndef RPM_GOVERNOR
+#define RPM_GOVERNOR 0
+#endif
+
+// Timing advance. 0: MOTOR_ADVANCE at every speed (SimonK). 1: by eRPM, from
+// ADVANCE_CURVE_POINTS in globals.h, looked up from timing in a flash table.
+#ifndef ADVANCE_CURVE
+#define ADVANCE_CURVE 0
+#endif
+
+// Logic analyzer markers on spare pins, an OR of the DEBUG_MARK_* classes in atmel.h:
+// 0x01 ZC, 0x02 SYNC, 0x04 COMMUTATION, 0x08 DEMAG, 0x10 PWM_ISR, 0x20 UPDATE_TIMING.
+// 0: none, and no code.
+#ifndef DEBUG_MARKERS
+#define DEBUG_MARKERS 0
+#endif
+
+// Saturating event counters and the shortest timing of the run, see perf_counters.h. A few
+// bytes of SRAM, an increment in branches that are already slow, and a 24 bit compare per
+// revolution.
+#ifndef PERF_COUNTERS
+#define PERF_COUNTERS 1
+#endif
+
+// Timing (eRPM) and control telemetry frames on the USART's TXD, see telemetry.h.
+#ifndef UART_TELEMETRY
+#define UART_TELEMETRY 0
+#endif
+
+#ifndef TELEMETRY_BAUD
+#define TELEMETRY_BAUD 115200ul
+#endif
+
+// Record the last 64 zero crossings, and keep (and with UART_TELEMETRY, dump) them when the
+// motor fails to run, see trace.h. 256 bytes of SRAM.
+#ifndef COMMUTATION_TRACE
+#define COMMUTATION_TRACE 0
+#endif
+
+// A throttle input is wired up, see wait_for_power_on() in control.cc.
+constexpr inline bool RC_INPUT = RC_PULS || DSHOT || TWI_SLAVE;
+
+// Commutation. 0: the run loop commutates once wait_OCT1_tot() sees the commutation time pass
+// (SimonK). 1: TIMER1_COMPA_vect commutates at the commutation time itself, and the
+// wait_OCT1_tot() loops sleep until an interrupt instead of spinning, see control.cc.
+#ifndef COMMUTATE_IN_ISR
+#define COMMUTATE_IN_ISR 0
+#endif
+
+// Benchmark build (make bench). The hot path functions marked BENCH_NOINLINE are kept out of
+// line, so host/simavr_bench.cc can find them in the ELF and time them one call at a time.
+// Costs a call/ret per use, so never set this for a flashed build.
+#ifndef BENCHMARK
+#define BENCHMARK 0
+#endif
+
+#if BENCHMARK
+#define BENCH_NOINLINE __attribute__((noinline, noclone))
+#else
+#define BENCH_NOINLINE
+#endif
+
 #endif
@@ -2,6 +2,8 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include "esc_config.h"
+#include "ticks24.h"
+#include "atmel.h"
 
 #ifndef GLOBALS_H
 #define GLOBALS_H
@@ -16,7 +18,19 @@
 
 // Constants
 constexpr inline uint8_t MOTOR_ADVANCE = 17; // Degrees of timing advance (0 - 30, 30 meaning no delay)
+// ADVANCE_CURVE: degrees of advance by eRPM, in place of MOTOR_ADVANCE. Linear between
+// the points, flat past either end. See advance_delay() in update_timing.cc.
+struct AdvancePoint {
+    uint32_t erpm;
+    uint8_t advance; // 0 - 30, like MOTOR_ADVANCE.
+};
+constexpr inline AdvancePoint ADVANCE_CURVE_POINTS[] = {
+    {10000, 10},
+    {40000, 17},
+    {120000, 25},
+};
 constexpr inline bool HIGH_SIDE_PWM = false;
+constexpr inline bool MOTOR_REVERSE = true; // Initial direction, SimonK's MOTOR_REVERSE order.
 constexpr inline uint16_t MIN_DUTY = 56 * cpu_mhz/16;
 constexpr inline uint16_t POWER_RANGE = 1500U * cpu_mhz/16 + MIN_DUTY;
 constexpr inline uint16_t PWR_MAX_RPM1 = (POWER_RANGE/6); //  Power limit when running slower than TIMING_RANGE1
@@ -34,6 +48,20 @@ constexpr inline uint16_t TIMING_RANGE2 = 0x2000;
 constexpr inline uint16_t TIMING_RANGE3 = 0x1000;
 
 constexpr inline uint8_t RCP_TOT = 2U; // Number of 65536us periods before considering rc pulse lost
+// RC_PULS pulse lengths, in us.
+constexpr inline uint16_t MIN_RC_PULS = 768U; // Shorter than this is not a valid pulse.
+constexpr inline uint16_t STOP_RC_PULS = 1060U; // Zero throttle at and below this.
+constexpr inline uint16_t FULL_RC_PULS = 1860U; // Full throttle at and above this.
+constexpr inline uint16_t MAX_RC_PULS = 2400U; // Longer than this is not a valid pulse.
+// RC_PULS protocols, told apart by the length of their pulses while arming, see
+// detect_rc_protocol(). The lengths above are RC_PROTOCOL_PWM's.
+enum RcProtocol : uint8_t {
+    RC_PROTOCOL_PWM, // 1060-1860us servo pulses.
+    RC_PROTOCOL_ONESHOT125, // 125-250us.
+    RC_PROTOCOL_ONESHOT42, // 42-84us.
+    RC_PROTOCOL_MULTISHOT, // 5-25us.
+    RC_PROTOCOL_COUNT,
+};
  // This many start cycles without timeout will transition to running mode
 // (tm4 experimental 05-01-18 - stock 12)
 constexpr inline uint8_t ENOUGH_GOODIES = 6;
@@ -53,6 +81,14 @@ constexpr inline uint8_t START_MOD_LIMIT = 48; // Value at which power is reduce
 constexpr inline uint32_t TIMEOUT_START = 10000; // Timeout per commutation for ZC during starting
 constexpr inline uint32_t TIMING_MAX = 0x023Bu; // ; Fixed or safety governor (no less than 0x0080, 321500eRPM).
 
+// RPM_GOVERNOR, see governor.h.
+constexpr inline uint32_t GOVERNOR_MAX_ERPM = 100000ul; // The target at full throttle.
+// 16.16 duty per eRPM of error: 1000 eRPM short is 1/64 of MAX_POWER more now, and the
+// integral adds that again every 2^GOVERNOR_KI_SHIFT (128) revolutions.
+constexpr inline int32_t GOVERNOR_KP = 0x10000l * MAX_POWER / 64 / 1000;
+constexpr inline uint8_t GOVERNOR_KI_SHIFT = 7;
+constexpr inline int16_t GOVERNOR_SLEW = MAX_POWER / 64; // Duty change per revolution.
+
 // Non Constants
 inline uint16_t safety_governor = 0x0000u * (cpu_mhz/2);
 
@@ -84,6 +120,7 @@ inline uint16_t rc_duty = 0x00;
 // Very in depth solution: Go and ensure that these PWM functions are in the lower 8 bits
 // for the function pointer, and then only set that half. But that's tricky and bug prone,
 // and I'd rather just use a slower ut functional solution until the migration to a 32 bit platform.
+// Update 2: PWM_JUMP_TABLE below does exactly that, keeping the entries in one page is what makes it safe.
 enum PWM_STATUS_ENUM : uint8_t {
     PWM_NOP = 0x00,
     PWM_OFF = 0x01,
@@ -92,19 +129,73 @@ enum PWM_STATUS_ENUM : uint8_t {
     PWM_ON_FAST_HIGH = 0x04,
     PWM_ON_HIGH = 0x05
 };
-inline volatile PWM_STATUS_ENUM PWM_STATUS = PWM_NOP;
+
+// PWM_JUMP_TABLE selects how TIMER2_OVF_vect finds its handler.
+// 0: PWM_STATUS holds a PWM_STATUS_ENUM, and the ISR switches on it.
+// 1: The SimonK ijmp approach. PWM_STATUS holds the low byte of the word address
+//    of a handler entry point, all of which sit in one 256 word page, so the naked
+//    vector only loads ZL, sets ZH to a constant and ijmps. See interrupts.cc.
+// Either way, only ever store values obtained from pwm_status() below.
+// 0 stays the default until 1 is built with avr-gcc and compared per state with make bench.
+#ifndef PWM_JUMP_TABLE
+#define PWM_JUMP_TABLE 0
+#endif
+
+#if PWM_JUMP_TABLE
+// Defined in the asm block in interrupts.cc, never call these!
+extern "C" {
+    void pwm_nop_entry();
+    void pwm_off_entry();
+    void pwm_on_entry();
+    void pwm_on_fast_entry();
+    void pwm_on_fast_high_entry();
+    void pwm_on_high_entry();
+}
+using pwm_status_t = uint8_t;
+
+// Only the low byte of the entry address is stored, the high byte is an ldi in the vector.
+// Called with a constant, this folds down to a single ldi of lo8(gs(pwm_*_entry)).
+inline pwm_status_t pwm_status(const PWM_STATUS_ENUM status) {
+    switch (status) {
+    case PWM_OFF:
+	return (uintptr_t) &pwm_off_entry;
+    case PWM_ON:
+	return (uintptr_t) &pwm_on_entry;
+    case PWM_ON_FAST:
+	return (uintptr_t) &pwm_on_fast_entry;
+    case PWM_ON_FAST_HIGH:
+	return (uintptr_t) &pwm_on_fast_high_entry;
+    case PWM_ON_HIGH:
+	return (uintptr_t) &pwm_on_high_entry;
+    case PWM_NOP:
+    default:
+	return (uintptr_t) &pwm_nop_entry;
+    }
+}
+#else
+using pwm_status_t = PWM_STATUS_ENUM;
+
+inline pwm_status_t pwm_status(const PWM_STATUS_ENUM status) {
+    return status;
+}
+#endif
+
+inline volatile uint8_t tcnt2h = 0; // 2nd byte of tcnt2.
+// Note: In PWM_JUMP_TABLE mode, 0 is not a valid entry, but switchPowerOff() sets this to
+// pwm_status(PWM_NOP) before the PWM timer is ever started.
+inline volatile pwm_status_t PWM_STATUS = pwm_status_t();
 // This looks to be set as part of eval RC, so make sure this happens!
 // AKA, I need to run set_new_duty!!
-inline volatile PWM_STATUS_ENUM PWM_ON_PTR = PWM_NOP;
+inline volatile pwm_status_t PWM_ON_PTR = pwm_status_t();
 
 // Timer related
-inline volatile bool oct1_pending = false;
+constexpr inline IoFlag<0> oct1_pending{};
 inline volatile uint8_t ocr1ax = 0; // third byte of OCR1A.
 inline volatile uint8_t tcnt1x = 0; // third byte of TCNT1.
-inline volatile uint8_t tcnt2h = 0; // 2nd byte of tcnt2.
 
-inline uint32_t last_tcnt1 = 0x00u; // Last Timer1 value.
-inline uint32_t last2_tcnt1 = 0x00u; // Last last Timer1 value.
+inline ticks24_t last_tcnt1; // Last Timer1 value.
+inline ticks24_t last2_tcnt1; // Last last Timer1 value.
+inline ticks24_t zc_tcnt1; // ZC_INTERRUPT/ZC_CAPTURE: Timer1 value at the comparator edge, read with interrupts off.
 
 // RC Timeout values
 inline volatile uint8_t rc_timeout = 0;
@@ -114,31 +205,57 @@ inline volatile uint8_t rct_beacon = 0; // Counter which increments while rc_tim
 // Motor Driving flags
 inline bool set_duty = false;
 inline bool power_on = false;
-inline volatile bool full_power = false;
+constexpr inline IoFlag<1> full_power{};
+// An input ISR posted a new throttle in posted_rc_duty, see post_rc_duty().
+constexpr inline IoFlag<3> eval_rc{};
+inline volatile uint16_t posted_rc_duty = 0;
+// UART_TELEMETRY: time for send_telemetry_if_due() to queue a frame.
+constexpr inline IoFlag<4> telemetry_due{};
+// TWI_SLAVE: the last 11 bit throttle written, see post_twi_throttle().
+inline volatile uint16_t posted_twi_throttle = 0;
+// RC_PULS: the last valid pulse, in Timer1 ticks, see post_rc_puls().
+inline volatile uint16_t posted_rc_puls = 0;
+inline ticks24_t rc_puls_start; // RC_PULS: Timer1 at the rising edge, TIMER1_CAPT_vect only.
+// RC_PULS: pulse lengths TIMER1_CAPT_vect posts, in Timer1 ticks. None until arming.
+inline volatile uint16_t rc_puls_min_ticks = 0;
+inline volatile uint16_t rc_puls_max_ticks = 0;
+inline RcProtocol rc_protocol = RC_PROTOCOL_PWM;
+// COMMUTATE_IN_ISR: the step the run loop is waiting to commutate, and the step
+// TIMER1_COMPA_vect runs when the commutation time passes. See wait_commutation().
+typedef void (*commutation_t)();
+inline commutation_t next_commutation = nullptr;
+inline volatile commutation_t scheduled_commutation = nullptr;
+// ZC_INTERRUPT/ZC_CAPTURE: the awaited comparator edge came, at zc_tcnt1.
+constexpr inline IoFlag<2> zc_edge_pending{};
 inline bool startup = false;
 inline bool aco_edge_high = false;
+// Direction to use at the next arming. Only DSHOT's spin direction commands change it,
+// RC_PULS and TWI_SLAVE have no way to ask, so those builds run MOTOR_REVERSE.
+inline bool reverse_requested = MOTOR_REVERSE;
+inline bool motor_reverse = MOTOR_REVERSE; // Direction of the commutation table being run.
 inline bool timing_fast = false; // Does timing fit in 16 bits?
 
 // Motor timing information.
 inline uint8_t power_skip = 6U;
 // Goodies: Amount of Good zero-cross detections, good commutations, that's all.
 inline uint8_t goodies = 0U;
-// Both of these are 24 bits in simonk with _x, we will need to bitmask for the fast methods.
-// Making these 32 bit might not be as efficient, but using 3 bytes is stupid messy,
-// and coercing the compiler to actually make a 24 bit int type seems tricky, so...
-// This is a problem that won't exist on a 32 bit platform anywho.
+// Both of these are 24 bits in simonk with _x, see ticks24.h.
 // timing_l, timing_h, timing_x
-inline uint32_t timing = 0x00U; // Interval of 2 commutations.
+inline ticks24_t timing; // Interval of 2 commutations.
 // com_time_l, com_time_h, com_time_x
-inline uint32_t com_timing = 0x00U; // time of last commutation.
+inline ticks24_t com_timing; // time of last commutation.
 
 
 inline uint16_t sys_control = 0x00u; // duty limit
 
 // FET STATUS
-inline volatile bool a_fet = false;
-inline volatile bool b_fet = false;
-inline volatile bool c_fet = false;
+// PWM_PORT as the PWM ISR writes it to start and end the on time: the current step's
+// PWM FET on or off, every other pin as of the last sync, see interrupts.h.
+// The XOR of the two is the PWM FET bit.
+inline volatile uint8_t pwm_port_on = 0x00u;
+inline volatile uint8_t pwm_port_off = 0x00u;
+// COMP_PWM: the phase whose pFET conducts in the PWM off period, PHASE_NONE for none.
+inline volatile uint8_t comp_fet = PHASE_NONE;
 
 // Startup vars
 inline uint8_t start_delay = 0x00u;
@@ -0,0 +1,69 @@
+#include "governor.h"
+
+#include "globals.h"
+#include "set_duty.h"
+
+// Target eRPM per throttle step, 24.8.
+constexpr inline uint32_t GOVERNOR_TARGET_SCALE = GOVERNOR_MAX_ERPM * 256ul / MAX_POWER;
+static_assert((uint64_t) MAX_POWER * GOVERNOR_TARGET_SCALE < 0x100000000ull, "The target fits 32 bits.");
+// timing * eRPM, see timing_to_erpm().
+constexpr inline uint32_t GOVERNOR_TIMING_ERPM = 60ul * cpu_mhz * 1000000ul / 3;
+// Near the target a timing tick is worth target / target timing eRPM, target^2 / the above.
+// So GOVERNOR_KP per tick is throttle^2 times this, shifted right 15.
+constexpr inline uint32_t GOVERNOR_GAIN_SCALE = (uint64_t) GOVERNOR_KP * GOVERNOR_TARGET_SCALE
+    * GOVERNOR_TARGET_SCALE * 0x8000u / 0x10000u / GOVERNOR_TIMING_ERPM;
+static_assert((uint64_t) MAX_POWER * MAX_POWER * GOVERNOR_GAIN_SCALE < 0x100000000ull,
+	      "The gain fits 32 bits.");
+
+void governor_start() {
+    governor_integral = (int32_t) rc_duty << 16;
+}
+
+void governor_update() {
+    const uint16_t throttle = governor_throttle;
+    if (throttle == 0) {
+	// rc_duty_set() stopped the motor, start the next throttle from nothing.
+	governor_integral = 0;
+	return;
+    }
+    if (throttle != governor_target_throttle) {
+	governor_target_throttle = throttle;
+	const uint32_t target_erpm = (throttle * GOVERNOR_TARGET_SCALE) >> 8;
+	governor_target_timing = GOVERNOR_TIMING_ERPM / target_erpm;
+	governor_gain = ((uint32_t) throttle * throttle * GOVERNOR_GAIN_SCALE) >> 15;
+    }
+    // Positive while too slow. No further than the target timing either way, so the
+    // product fits, and that is past the slew limit anyway.
+    const int32_t target = governor_target_timing;
+    int32_t error = (int32_t) timing.widen() - target;
+    if (error > target) {
+	error = target;
+    } else if (error < -target) {
+	error = -target;
+    }
+    const int32_t proportional = error * governor_gain;
+
+    // Anti-windup: no integral past what the duty limits let through.
+    const uint16_t ceiling = timing_duty < sys_control ? timing_duty : sys_control;
+    int32_t integral = governor_integral + (proportional >> GOVERNOR_KI_SHIFT);
+    if (integral > ((int32_t) ceiling << 16)) {
+	integral = (int32_t) ceiling << 16;
+    } else if (integral < ((int32_t) MIN_DUTY << 16)) {
+	integral = (int32_t) MIN_DUTY << 16;
+    }
+    governor_integral = integral;
+
+    int32_t output = (integral + proportional) >> 16;
+    if (output > rc_duty + GOVERNOR_SLEW) {
+	output = rc_duty + GOVERNOR_SLEW;
+    } else if (output < (int32_t) rc_duty - GOVERNOR_SLEW) {
+	output = (int32_t) rc_duty - GOVERNOR_SLEW;
+    }
+    if (output > MAX_POWER) {
+	output = MAX_POWER;
+    } else if (output < MIN_DUTY) {
+	output = MIN_DUTY;
+    }
+    rc_duty = output;
+    set_new_duty_l(output);
+}
@@ -0,0 +1,38 @@
+#include <stdint.h>
+
+#ifndef GOVERNOR_H
+#define GOVERNOR_H
+
+////////////////////////////////////////////////////////////////////////////////////////
+// RPM governor, RPM_GOVERNOR in esc_config.h. The throttle (0 to MAX_POWER) selects  //
+// a target eRPM up to GOVERNOR_MAX_ERPM, and a PI controller sets rc_duty to hold    //
+// it, once per electrical revolution (6 commutations) from run(), while running.     //
+// rc_duty_set() keeps the throttle in governor_throttle instead of rc_duty while     //
+// running, except for zero throttle, which still stops the motor straight away.      //
+// 										      //
+// The first governor_update() after the throttle changes turns it into a target      //
+// timing, and GOVERNOR_KP into duty per timing tick at that target, so the PI runs   //
+// on the timing error with one multiply and no divide a revolution. The integral is  //
+// duty in 16.16.								      //
+// Anti-windup clamps the integral to what the duty limits (timing_duty and	      //
+// sys_control) let through, and the output moves at most GOVERNOR_SLEW a revolution. //
+////////////////////////////////////////////////////////////////////////////////////////
+
+// The throttle the input last set, see rc_duty_set().
+inline uint16_t governor_throttle = 0;
+// The throttle of the target timing, and the proportional gain there, 16.16 duty per tick.
+inline uint16_t governor_target_throttle = 0;
+inline uint32_t governor_target_timing = 0;
+inline uint32_t governor_gain = 0;
+inline int32_t governor_integral = 0;
+
+// From rc_duty_set(), for every throttle, so also from the wait loops. Only stores it, the
+// divide for the target is left to governor_update().
+inline void governor_set_target(const uint16_t throttle) {
+    governor_throttle = throttle;
+}
+// Seed the controller from the starting duty.
+void governor_start();
+// Once per electrical revolution, from run().
+void governor_update();
+#endif
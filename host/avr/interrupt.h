@@ -0,0 +1,16 @@
+#include "io.h"
+
+#ifndef HOST_AVR_INTERRUPT_H
+#define HOST_AVR_INTERRUPT_H
+
+// Host stand in for <avr/interrupt.h>, see host/sim.h.
+// ISRs are plain extern "C" functions, host/sim.cc calls them by vector name.
+#define ISR_NAKED
+#define ISR_BLOCK
+#define ISR_NOBLOCK
+#define ISR(vector, ...) extern "C" void vector(void); extern "C" void vector(void)
+
+#define cli() sim::disable_interrupts()
+#define sei() sim::enable_interrupts()
+
+#endif
@@ -0,0 +1,179 @@
+#include <stdint.h>
+#include "../sim.h"
+
+#ifndef HOST_AVR_IO_H
+#define HOST_AVR_IO_H
+
+// Host stand in for <avr/io.h> (ATmega8), see host/sim.h.
+
+inline sim::Reg8 PINB{sim::R_PINB};
+inline sim::Reg8 DDRB{sim::R_DDRB};
+inline sim::Reg8 PORTB{sim::R_PORTB};
+inline sim::Reg8 PINC{sim::R_PINC};
+inline sim::Reg8 DDRC{sim::R_DDRC};
+inline sim::Reg8 PORTC{sim::R_PORTC};
+inline sim::Reg8 PIND{sim::R_PIND};
+inline sim::Reg8 DDRD{sim::R_DDRD};
+inline sim::Reg8 PORTD{sim::R_PORTD};
+
+inline sim::Reg8 TCCR0{sim::R_TCCR0};
+inline sim::Reg8 TCNT0{sim::R_TCNT0};
+inline sim::Reg8 TCCR1A{sim::R_TCCR1A};
+inline sim::Reg8 TCCR1B{sim::R_TCCR1B};
+inline sim::Reg16 TCNT1{sim::R_TCNT1};
+inline sim::Reg16 OCR1A{sim::R_OCR1A};
+inline sim::Reg16 OCR1B{sim::R_OCR1B};
+inline sim::Reg16 ICR1{sim::R_ICR1};
+inline sim::Reg8 TCCR2{sim::R_TCCR2};
+inline sim::Reg8 TCNT2{sim::R_TCNT2};
+inline sim::Reg8 OCR2{sim::R_OCR2};
+inline sim::Reg8 TIFR{sim::R_TIFR};
+inline sim::Reg8 TIMSK{sim::R_TIMSK};
+
+inline sim::Reg8 ACSR{sim::R_ACSR};
+inline sim::Reg8 SFIOR{sim::R_SFIOR};
+inline sim::Reg8 ADCSRA{sim::R_ADCSRA};
+inline sim::Reg8 ADMUX{sim::R_ADMUX};
+
+inline sim::Reg8 MCUCR{sim::R_MCUCR};
+inline sim::Reg8 GICR{sim::R_GICR};
+inline sim::Reg8 GIFR{sim::R_GIFR};
+
+inline sim::Reg8 EEDR{sim::R_EEDR};
+
+inline sim::Reg8 UDR{sim::R_UDR};
+inline sim::Reg8 UCSRA{sim::R_UCSRA};
+inline sim::Reg8 UCSRB{sim::R_UCSRB};
+inline sim::Reg8 UCSRC{sim::R_UCSRC};
+inline sim::Reg8 UBRRL{sim::R_UBRRL};
+inline sim::Reg8 UBRRH{sim::R_UBRRH};
+
+inline sim::Reg8 TWBR{sim::R_TWBR};
+inline sim::Reg8 TWSR{sim::R_TWSR};
+inline sim::Reg8 TWAR{sim::R_TWAR};
+inline sim::Reg8 TWDR{sim::R_TWDR};
+inline sim::Reg8 TWCR{sim::R_TWCR};
+
+inline sim::Reg8 SREG{sim::R_SREG};
+inline sim::Reg8 SPL{sim::R_SPL};
+inline sim::Reg8 SPH{sim::R_SPH};
+
+#define RAMEND 0x45F
+
+// TCCR0
+#define CS02 2
+#define CS01 1
+#define CS00 0
+// TCCR1A
+#define COM1A1 7
+#define COM1A0 6
+#define WGM11 1
+#define WGM10 0
+// TCCR1B
+#define ICNC1 7
+#define ICES1 6
+#define WGM13 4
+#define WGM12 3
+#define CS12 2
+#define CS11 1
+#define CS10 0
+// TCCR2
+#define FOC2 7
+#define WGM20 6
+#define COM21 5
+#define COM20 4
+#define WGM21 3
+#define CS22 2
+#define CS21 1
+#define CS20 0
+// TIMSK
+#define OCIE2 7
+#define TOIE2 6
+#define TICIE1 5
+#define OCIE1A 4
+#define OCIE1B 3
+#define TOIE1 2
+#define TOIE0 0
+// TIFR
+#define OCF2 7
+#define TOV2 6
+#define ICF1 5
+#define OCF1A 4
+#define OCF1B 3
+#define TOV1 2
+#define TOV0 0
+// ACSR
+#define ACD 7
+#define ACBG 6
+#define ACO 5
+#define ACI 4
+#define ACIE 3
+#define ACIC 2
+#define ACIS1 1
+#define ACIS0 0
+// SFIOR
+#define ACME 3
+// ADCSRA
+#define ADEN 7
+// MCUCR
+#define SE 7
+#define SM2 6
+#define SM1 5
+#define SM0 4
+#define ISC11 3
+#define ISC10 2
+#define ISC01 1
+#define ISC00 0
+// GICR / GIFR
+#define INT1 7
+#define INT0 6
+#define INTF1 7
+#define INTF0 6
+// UCSRA
+#define RXC 7
+#define TXC 6
+#define UDRE 5
+#define U2X 1
+// UCSRB
+#define RXCIE 7
+#define TXCIE 6
+#define UDRIE 5
+#define RXEN 4
+#define TXEN 3
+// UCSRC
+#define URSEL 7
+#define UCSZ1 2
+#define UCSZ0 1
+// TWCR
+#define TWINT 7
+#define TWEA 6
+#define TWSTA 5
+#define TWSTO 4
+#define TWWC 3
+#define TWEN 2
+#define TWIE 0
+// TWAR
+#define TWGCE 0
+// Pins
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PC0 0
+#define PC1 1
+#define PC2 2
+#define PC3 3
+#define PC4 4
+#define PC5 5
+#define PD0 0
+#define PD1 1
+#define PD2 2
+#define PD3 3
+#define PD4 4
+#define PD5 5
+#define PD6 6
+#define PD7 7
+
+#endif
@@ -0,0 +1,12 @@
+#include <stdint.h>
+
+#ifndef HOST_AVR_PGMSPACE_H
+#define HOST_AVR_PGMSPACE_H
+
+// Host stand in for <avr/pgmspace.h>, see host/sim.h. Flash is ordinary memory.
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t*) (addr))
+#define pgm_read_word(addr) (*(const uint16_t*) (addr))
+#define pgm_read_dword(addr) (*(const uint32_t*) (addr))
+
+#endif
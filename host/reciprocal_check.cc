@@ -0,0 +1,37 @@
+#include <stdio.h>
+#include "../duty_limit.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+// Host check of low_speed_duty_limit(), see duty_limit.h: every 24 bit timing from    //
+// DUTY_LIMIT_MIN_TIMING up against the divide it replaces, clamped to PWR_MAX_RPM1.  //
+// -1/+0 off the quotient, and exact once clamped. make host-check, exits 1 on a miss. //
+////////////////////////////////////////////////////////////////////////////////////////
+
+int main() {
+    uint32_t checked = 0;
+    uint32_t one_under = 0;
+    uint32_t misses = 0;
+    for (uint32_t t = DUTY_LIMIT_MIN_TIMING.widen(); t <= 0xFFFFFFu; ++t) {
+	uint32_t exact = DUTY_LIMIT_DIVIDEND / t;
+	if (exact < PWR_MAX_RPM1) {
+	    exact = PWR_MAX_RPM1;
+	}
+	const uint16_t duty = low_speed_duty_limit(ticks24_t::wrap(t));
+	++checked;
+	if (duty == exact) {
+	    continue;
+	}
+	if (duty + 1u == exact && exact != PWR_MAX_RPM1) {
+	    ++one_under;
+	    continue;
+	}
+	if (misses < 10) {
+	    printf("miss timing=%u duty=%u exact=%u\n", t, duty, exact);
+	}
+	++misses;
+    }
+    printf("reciprocal_checked=%u\n", checked);
+    printf("reciprocal_one_under=%u\n", one_under);
+    printf("reciprocal_misses=%u\n", misses);
+    return misses == 0 ? 0 : 1;
+}
@@ -0,0 +1,880 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <avr/io.h>
+#include "../esc_config.h"
+#include "../byte_manipulation.h"
+#include "../atmel.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+// Host simulation core, see sim.h.						      //
+// 										      //
+// Motor model: star connected BLDC with sinusoidal back-EMF, phase resistance only   //
+// (no inductance), and a viscous + propeller-like drag. Driven phases follow the     //
+// FET pins, so shoot-through and floating phases come straight from the firmware.    //
+// The comparator compares the phase on the negative input (ADC mux or AIN1) with     //
+// AIN0, the resistor network neutral, like on the afro_nfet.			      //
+////////////////////////////////////////////////////////////////////////////////////////
+
+int firmware_main();
+
+// Vectors the firmware may or may not define, in ATmega8 priority order.
+extern "C" {
+void INT0_vect() __attribute__((weak));
+void INT1_vect() __attribute__((weak));
+void TIMER2_COMP_vect() __attribute__((weak));
+void TIMER2_OVF_vect() __attribute__((weak));
+void TIMER1_CAPT_vect() __attribute__((weak));
+void TIMER1_COMPA_vect() __attribute__((weak));
+void TIMER1_COMPB_vect() __attribute__((weak));
+void TIMER1_OVF_vect() __attribute__((weak));
+void TIMER0_OVF_vect() __attribute__((weak));
+void USART_RXC_vect() __attribute__((weak));
+void USART_UDRE_vect() __attribute__((weak));
+void USART_TXC_vect() __attribute__((weak));
+void ANA_COMP_vect() __attribute__((weak));
+void TWI_vect() __attribute__((weak));
+}
+
+namespace sim {
+namespace {
+
+constexpr double F_CLK = F_OSC;
+constexpr uint64_t REG_ACCESS_CYCLES = 1;
+constexpr uint64_t POLL_CYCLES = 4;
+// Interrupt response, reti, and a typical prologue/epilogue.
+constexpr uint64_t ISR_CYCLES = 20;
+constexpr uint64_t MAX_STEP_CYCLES = 16;
+
+enum Drive : uint8_t { FLOAT, HIGH, LOW, SHORT };
+constexpr uint8_t NO_PHASE = 0xFF;
+
+struct Options {
+    double seconds = 2.0;
+    double voltage = 12.0;
+    double resistance = 0.1; // Ohm, per phase.
+    double ke = 0.0008; // V per electrical rad/s, phase peak.
+    double inertia = 8e-7; // Electrical domain.
+    double friction = 2e-9; // Viscous.
+    double drag = 0.0; // Propeller-like, times w * |w|.
+    double angle = 0.0; // Initial electrical angle, degrees.
+    double noise = 0.0; // Comparator input noise, volts peak.
+    double rc_puls = 0.0; // RC pulse on ICP1 (PB0) in us, 0 for none.
+    double rc_arm = 1000.0; // RC pulse before RC_ARM_SECONDS, in us.
+    double rc_hz = 50.0; // RC pulse rate.
+    double dshot = -1.0; // DShot throttle on ICP1 in place of RC pulses, -1 for none.
+    double dshot_kbit = 300.0;
+    double twi = -1.0; // 11 bit TWI throttle written every RC frame, -1 for none.
+    double twi_motor = 1.0; // The MikroKopter motor number addressed.
+    bool trace = false;
+} options;
+
+uint8_t regs[REG_COUNT];
+uint16_t tcnt1, ocr1a, ocr1b, icr1;
+uint8_t ocr2_buffer;
+uint64_t prescale_acc[3];
+bool interrupts_enabled = false;
+bool in_isr = false;
+uint64_t cycles = 0;
+uint64_t end_cycles = 0;
+
+// Motor state.
+double theta = 0.0;
+double omega = 0.0;
+double max_omega = 0.0;
+bool last_aco = false;
+bool last_icp1 = false;
+
+// Statistics.
+uint64_t commutations = 0;
+uint64_t shoot_through = 0;
+uint64_t isr_counts[14];
+uint8_t high_phase = NO_PHASE;
+uint8_t low_phase = NO_PHASE;
+bool zc_seen = false;
+int zc_sign = 0;
+double zc_theta = 0.0;
+uint64_t zc_cycles = 0;
+uint64_t delays = 0;
+double delay_sum = 0.0;
+double delay_min = 1e9;
+double delay_max = -1e9;
+
+constexpr double TWO_PI = 6.283185307179586;
+
+uint32_t prescaler(const uint8_t control, const bool timer2) {
+    static const uint32_t timer01[8] = {0, 1, 8, 64, 256, 1024, 0, 0}; // 6/7: external clock, not modelled.
+    static const uint32_t timer_2[8] = {0, 1, 8, 32, 64, 128, 256, 1024};
+    return timer2 ? timer_2[control & 0x07u] : timer01[control & 0x07u];
+}
+
+uint32_t timer_ticks(const uint8_t idx, const uint8_t control, const bool timer2, const uint64_t n) {
+    const uint32_t p = prescaler(control, timer2);
+    if (p == 0) {
+	return 0;
+    }
+    prescale_acc[idx] += n;
+    const uint32_t ticks = prescale_acc[idx] / p;
+    prescale_acc[idx] %= p;
+    return ticks;
+}
+
+// Does a counter going from old to old + ticks pass through compare?
+bool passes(const uint32_t old, const uint32_t ticks, const uint32_t compare, const uint32_t mask) {
+    return ticks != 0 && ((compare - old - 1) & mask) < ticks;
+}
+
+void tick_timers(const uint64_t n) {
+    uint32_t ticks = timer_ticks(0, regs[R_TCCR0], false, n);
+    if (ticks != 0) {
+	const uint32_t count = regs[R_TCNT0] + ticks;
+	if (count > 0xFFu) {
+	    regs[R_TIFR] |= getByteWithBitSet(TOV0);
+	}
+	regs[R_TCNT0] = count;
+    }
+
+    ticks = timer_ticks(1, regs[R_TCCR1B], false, n);
+    if (ticks != 0) {
+	if (passes(tcnt1, ticks, ocr1a, 0xFFFFu)) {
+	    regs[R_TIFR] |= getByteWithBitSet(OCF1A);
+	}
+	if (passes(tcnt1, ticks, ocr1b, 0xFFFFu)) {
+	    regs[R_TIFR] |= getByteWithBitSet(OCF1B);
+	}
+	const uint32_t count = tcnt1 + ticks;
+	if (count > 0xFFFFu) {
+	    regs[R_TIFR] |= getByteWithBitSet(TOV1);
+	}
+	tcnt1 = count;
+    }
+
+    ticks = timer_ticks(2, regs[R_TCCR2], true, n);
+    if (ticks != 0) {
+	if (passes(regs[R_TCNT2], ticks, regs[R_OCR2], 0xFFu)) {
+	    regs[R_TIFR] |= getByteWithBitSet(OCF2);
+	}
+	const uint32_t count = regs[R_TCNT2] + ticks;
+	if (count > 0xFFu) {
+	    regs[R_TIFR] |= getByteWithBitSet(TOV2);
+	    // Fast PWM: OCR2 is double buffered, and updated at BOTTOM.
+	    if ((regs[R_TCCR2] & getByteWithBitSet(WGM20)) != 0) {
+		regs[R_OCR2] = ocr2_buffer;
+	    }
+	}
+	regs[R_TCNT2] = count;
+    }
+}
+
+bool pin(const Reg port, const uint8_t idx) {
+    // DDR is the register before PORT.
+    const Reg ddr = Reg(port - 1);
+    return (regs[port] & regs[ddr] & getByteWithBitSet(idx)) != 0;
+}
+
+bool pin_is_output(const Reg port, const uint8_t idx) {
+    return (regs[Reg(port - 1)] & getByteWithBitSet(idx)) != 0;
+}
+
+Drive phase_drive(const Reg n_port, const uint8_t n_idx, const Reg p_port, const uint8_t p_idx) {
+    // nFETs are active high, pFETs active low. An input pin leaves its FET off.
+    const bool n_on = pin(n_port, n_idx);
+    const bool p_on = pin_is_output(p_port, p_idx) && !pin(p_port, p_idx);
+    if (n_on && p_on) {
+	return SHORT;
+    }
+    if (p_on) {
+	return HIGH;
+    }
+    if (n_on) {
+	return LOW;
+    }
+    return FLOAT;
+}
+
+void phase_drives(Drive drive[3]) {
+    drive[0] = phase_drive(ANFET_PORT.reg, AnFetIdx, APFET_PORT.reg, ApFetIdx);
+    drive[1] = phase_drive(BNFET_PORT.reg, BnFetIdx, BPFET_PORT.reg, BpFetIdx);
+    drive[2] = phase_drive(CNFET_PORT.reg, CnFetIdx, CPFET_PORT.reg, CpFetIdx);
+}
+
+double emf(const uint8_t phase) {
+    return options.ke * omega * sin(theta - phase * TWO_PI / 3.0);
+}
+
+// Which phase the comparator's negative input sees, per the mux setup in atmel.h.
+uint8_t comparator_phase() {
+    const bool mux_enabled = (regs[R_SFIOR] & getByteWithBitSet(ACME)) != 0
+	&& (regs[R_ADCSRA] & getByteWithBitSet(ADEN)) == 0;
+    if (mux_enabled) {
+	const uint8_t channel = regs[R_ADMUX] & 0x07u;
+	if (mux_a_defined && channel == admux_bitmask_to_enable_mux_a) {
+	    return 0;
+	}
+	if (mux_b_defined && channel == admux_bitmask_to_enable_mux_b) {
+	    return 1;
+	}
+	if (mux_c_defined && channel == admux_bitmask_to_enable_mux_c) {
+	    return 2;
+	}
+	return NO_PHASE;
+    }
+    // AIN1 carries whichever phase has no mux.
+    if (!mux_a_defined) {
+	return 0;
+    }
+    if (!mux_b_defined) {
+	return 1;
+    }
+    return 2;
+}
+
+void update_comparator(const double terminal[3], const double neutral) {
+    const uint8_t phase = comparator_phase();
+    double negative = neutral;
+    if (phase != NO_PHASE) {
+	negative = terminal[phase];
+    }
+    if (options.noise > 0.0) {
+	negative += options.noise * (2.0 * rand() / RAND_MAX - 1.0);
+    }
+    // ACO is set while AIN0 is above the negative input.
+    const bool aco = neutral > negative;
+    if (aco) {
+	regs[R_ACSR] |= getByteWithBitSet(ACO);
+    } else {
+	regs[R_ACSR] &= getByteWithBitCleared(ACO);
+    }
+    if (aco == last_aco) {
+	return;
+    }
+    last_aco = aco;
+    const uint8_t mode = regs[R_ACSR] & (getByteWithBitSet(ACIS1) | getByteWithBitSet(ACIS0));
+    const bool rising_mode = mode == (getByteWithBitSet(ACIS1) | getByteWithBitSet(ACIS0));
+    const bool falling_mode = mode == getByteWithBitSet(ACIS1);
+    if (mode == 0 || (rising_mode && aco) || (falling_mode && !aco)) {
+	regs[R_ACSR] |= getByteWithBitSet(ACI);
+    }
+    // ACIC routes the comparator into Timer1's input capture, edge per ICES1.
+    if ((regs[R_ACSR] & getByteWithBitSet(ACIC)) != 0
+	&& aco == ((regs[R_TCCR1B] & getByteWithBitSet(ICES1)) != 0)) {
+	icr1 = tcnt1;
+	regs[R_TIFR] |= getByteWithBitSet(ICF1);
+    }
+}
+
+void track_commutation(const Drive drive[3]) {
+    uint8_t high = high_phase;
+    uint8_t low = low_phase;
+    for (uint8_t phase = 0; phase < 3; ++phase) {
+	if (drive[phase] == SHORT) {
+	    ++shoot_through;
+	}
+	if (drive[phase] == HIGH) {
+	    high = phase;
+	}
+	// Low side PWM: all nFETs off during the off period is not a commutation.
+	if (drive[phase] == LOW) {
+	    low = phase;
+	}
+    }
+    if (high == high_phase && low == low_phase) {
+	return;
+    }
+    high_phase = high;
+    low_phase = low;
+    if (high == NO_PHASE || low == NO_PHASE || high == low) {
+	return;
+    }
+    ++commutations;
+    if (zc_seen) {
+	const double delay = fabs(theta - zc_theta) * 360.0 / TWO_PI;
+	++delays;
+	delay_sum += delay;
+	delay_min = fmin(delay_min, delay);
+	delay_max = fmax(delay_max, delay);
+    }
+    if (options.trace) {
+	printf("commutation,%.3f,%u,%u,%.1f,%.1f\n", cycles * 1e6 / F_CLK, high, low,
+	       omega * 60.0 / TWO_PI, zc_seen ? fabs(theta - zc_theta) * 360.0 / TWO_PI : -1.0);
+    }
+    zc_seen = false;
+    zc_sign = 0;
+}
+
+void step_motor(const uint64_t n) {
+    const double dt = n / F_CLK;
+    Drive drive[3];
+    phase_drives(drive);
+
+    double e[3];
+    double driven_sum = 0.0;
+    uint8_t driven = 0;
+    for (uint8_t phase = 0; phase < 3; ++phase) {
+	e[phase] = emf(phase);
+	if (drive[phase] == HIGH || drive[phase] == LOW) {
+	    driven_sum += (drive[phase] == HIGH ? options.voltage : 0.0) - e[phase];
+	    ++driven;
+	}
+    }
+    // Star point, from the driven phases, or the EMF average if nothing is driven.
+    const double star = driven != 0 ? driven_sum / driven : 0.0;
+    double terminal[3];
+    double torque = 0.0;
+    double neutral = 0.0;
+    for (uint8_t phase = 0; phase < 3; ++phase) {
+	if (drive[phase] == HIGH || drive[phase] == LOW) {
+	    terminal[phase] = drive[phase] == HIGH ? options.voltage : 0.0;
+	    const double current = (terminal[phase] - e[phase] - star) / options.resistance;
+	    torque += options.ke * current * sin(theta - phase * TWO_PI / 3.0);
+	} else {
+	    terminal[phase] = star + e[phase];
+	}
+	neutral += terminal[phase] / 3.0;
+    }
+    // A shorted phase is an overcurrent trip on a real board; here it simply stops driving.
+    for (uint8_t phase = 0; phase < 3; ++phase) {
+	if (drive[phase] == SHORT) {
+	    torque = 0.0;
+	}
+    }
+
+    torque -= options.friction * omega + options.drag * omega * fabs(omega);
+    omega += torque / options.inertia * dt;
+    theta += omega * dt;
+    max_omega = fmax(max_omega, fabs(omega));
+
+    // Zero crossing of the floating phase's EMF.
+    for (uint8_t phase = 0; phase < 3; ++phase) {
+	if (phase == high_phase || phase == low_phase) {
+	    continue;
+	}
+	const int sign = e[phase] > 0.0 ? 1 : -1;
+	if (zc_sign != 0 && sign != zc_sign && !zc_seen) {
+	    zc_seen = true;
+	    zc_theta = theta;
+	    zc_cycles = cycles;
+	}
+	zc_sign = sign;
+    }
+
+    update_comparator(terminal, neutral);
+}
+
+// RC pulses on ICP1: options.rc_arm long at first so the firmware arms, then options.rc_puls.
+// Or DShot frames, throttle 0 at first, then options.dshot.
+constexpr double RC_ARM_SECONDS = 1.5;
+
+bool dshot_level(const uint64_t at, const uint64_t frame_cycles) {
+    const uint16_t throttle = at < RC_ARM_SECONDS * F_CLK ? 0 : (uint16_t) options.dshot;
+    const uint16_t value = throttle << 1;
+    const uint16_t frame = (value << 4) | ((value ^ (value >> 4) ^ (value >> 8)) & 0x0Fu);
+    const double bit_cycles = F_CLK / (options.dshot_kbit * 1000.0);
+    const uint64_t bit = frame_cycles / bit_cycles;
+    if (bit >= 16) {
+	return false;
+    }
+    const double into_bit = (frame_cycles - bit * bit_cycles) / bit_cycles;
+    return into_bit < ((frame & (0x8000u >> bit)) != 0 ? 0.75 : 0.375);
+}
+
+bool rc_level(const uint64_t at) {
+    const uint64_t frame = F_CLK / options.rc_hz;
+    if (options.dshot >= 0.0) {
+	return dshot_level(at, at % frame);
+    }
+    const double puls = at < RC_ARM_SECONDS * F_CLK ? options.rc_arm : options.rc_puls;
+    return at % frame < puls * F_CLK / 1e6;
+}
+
+void step_rc_puls(const uint64_t n) {
+    if (options.rc_puls <= 0.0 && options.dshot < 0.0) {
+	return;
+    }
+    const bool icp1 = rc_level(cycles);
+    if (icp1 == last_icp1) {
+	return;
+    }
+    last_icp1 = icp1;
+    if (icp1) {
+	regs[R_PINB] |= getByteWithBitSet(PB0);
+    } else {
+	regs[R_PINB] &= getByteWithBitCleared(PB0);
+    }
+    if ((regs[R_ACSR] & getByteWithBitSet(ACIC)) == 0
+	&& icp1 == ((regs[R_TCCR1B] & getByteWithBitSet(ICES1)) != 0)) {
+	// Timer1 runs at CLK/1 (T1CLK), so capture the cycle of the edge itself, rather than
+	// the end of the step, which DShot's bit timing is too tight for.
+	uint64_t edge = cycles;
+	while (edge + n > cycles + 1 && rc_level(edge - 1) == icp1) {
+	    --edge;
+	}
+	icr1 = tcnt1 - (cycles - edge);
+	regs[R_TIFR] |= getByteWithBitSet(ICF1);
+    }
+}
+
+// TWI master, MikroKopter style: every RC frame, write the throttle to the motor's
+// address, then read back the status. Each event is one byte on the bus, raised once
+// the firmware has released the last one (written TWINT) and the byte time has passed.
+struct TwiEvent {
+    uint8_t status; // TWSR.
+    uint8_t data; // TWDR, for a received byte.
+};
+constexpr uint64_t TWI_BYTE_CYCLES = F_CLK * 9 / 400000; // 400kHz.
+constexpr uint8_t TWI_READ_BYTES = 5;
+TwiEvent twi_events[16];
+uint8_t twi_event_count = 0;
+uint8_t twi_next = 0;
+uint64_t twi_next_cycles = 0;
+bool twi_collect = false; // The firmware loads TWDR for the master while it holds the bus.
+uint8_t twi_read[TWI_READ_BYTES];
+uint8_t twi_read_count = 0;
+uint8_t twi_status[TWI_READ_BYTES];
+uint64_t twi_reads = 0;
+
+void twi_transaction() {
+    const uint16_t throttle = cycles < RC_ARM_SECONDS * F_CLK ? 0 : (uint16_t) options.twi;
+    uint8_t n = 0;
+    twi_events[n++] = {0x60u, 0};
+    twi_events[n++] = {0x80u, (uint8_t) (throttle >> 3)};
+    twi_events[n++] = {0x80u, (uint8_t) (throttle & 0x07u)};
+    twi_events[n++] = {0xA0u, 0};
+    twi_events[n++] = {0xA8u, 0};
+    for (uint8_t i = 1; i < TWI_READ_BYTES; ++i) {
+	twi_events[n++] = {0xB8u, 0};
+    }
+    twi_events[n++] = {0xC0u, 0};
+    twi_event_count = n;
+    twi_next = 0;
+    twi_read_count = 0;
+}
+
+void step_twi() {
+    if (options.twi < 0.0 || (regs[R_TWCR] & getByteWithBitSet(TWEN)) == 0
+	|| (regs[R_TWCR] & getByteWithBitSet(TWINT)) != 0 || cycles < twi_next_cycles) {
+	return;
+    }
+    if (twi_collect) {
+	twi_collect = false;
+	twi_read[twi_read_count++] = regs[R_TWDR];
+	if (twi_read_count == TWI_READ_BYTES) {
+	    memcpy(twi_status, twi_read, sizeof(twi_status));
+	    ++twi_reads;
+	}
+    }
+    if (twi_next == twi_event_count) {
+	twi_next_cycles = cycles + F_CLK / options.rc_hz;
+	twi_event_count = 0;
+	// A slave with another address doesn't ACK, and never sees the rest.
+	if (regs[R_TWAR] >> 1 == (0x52u >> 1) + (uint8_t) options.twi_motor - 1) {
+	    twi_transaction();
+	}
+	return;
+    }
+    const TwiEvent& event = twi_events[twi_next++];
+    regs[R_TWSR] = event.status;
+    if (event.status == 0x80u) {
+	regs[R_TWDR] = event.data;
+    }
+    regs[R_TWCR] |= getByteWithBitSet(TWINT);
+    twi_collect = event.status == 0xA8u || event.status == 0xB8u;
+    twi_next_cycles = cycles + TWI_BYTE_CYCLES;
+}
+
+// USART transmitter: UDR feeds the shift register, which takes a 10 bit 8N1 frame at
+// the baud rate set by UBRR and U2X. UDRE is clear while a byte waits in UDR.
+// Transmitted bytes are decoded as telemetry and counters frames, see telemetry.h, and
+// commutation trace dumps, see trace.h.
+constexpr uint8_t TELEMETRY_FRAME_BYTES = 11;
+constexpr uint8_t COUNTERS_FRAME_BYTES = 13;
+constexpr uint16_t TRACE_DUMP_MAX_BYTES = 3 + 4 * 255;
+bool udr_full = false;
+uint8_t udr_buffer = 0;
+uint64_t usart_shift_end = 0; // Cycle the byte in the shift register is out.
+uint8_t usart_frame[TRACE_DUMP_MAX_BYTES];
+uint16_t usart_frame_count = 0;
+uint64_t usart_bytes = 0;
+uint64_t telemetry_frames = 0;
+uint64_t telemetry_bad_frames = 0;
+uint8_t telemetry_last[TELEMETRY_FRAME_BYTES];
+uint64_t trace_dumps = 0;
+uint64_t counters_frames = 0;
+uint8_t counters_last[COUNTERS_FRAME_BYTES];
+uint8_t trace_last[TRACE_DUMP_MAX_BYTES];
+
+uint64_t usart_byte_cycles() {
+    const uint16_t ubrr = (regs[R_UBRRH] & 0x0Fu) << 8 | regs[R_UBRRL];
+    const uint8_t divider = (regs[R_UCSRA] & getByteWithBitSet(U2X)) != 0 ? 8 : 16;
+    return 10ull * divider * (ubrr + 1u);
+}
+
+void usart_received(const uint8_t byte) {
+    ++usart_bytes;
+    if (usart_frame_count == 0 && byte != 0xA5u && byte != 0x5Au && byte != 0xC3u) {
+	++telemetry_bad_frames;
+	return;
+    }
+    usart_frame[usart_frame_count++] = byte;
+    const bool dump = usart_frame[0] == 0x5Au;
+    const bool counters = usart_frame[0] == 0xC3u;
+    if (usart_frame_count < 2) {
+	return;
+    }
+    const uint16_t length = dump ? 3 + 4 * usart_frame[1]
+	: counters ? COUNTERS_FRAME_BYTES : TELEMETRY_FRAME_BYTES;
+    if (usart_frame_count != length) {
+	return;
+    }
+    usart_frame_count = 0;
+    uint8_t check = 0;
+    for (uint16_t i = 1; i < length - 1; ++i) {
+	check ^= usart_frame[i];
+    }
+    if (check != usart_frame[length - 1]) {
+	++telemetry_bad_frames;
+	return;
+    }
+    if (dump) {
+	++trace_dumps;
+	memcpy(trace_last, usart_frame, length);
+	return;
+    }
+    if (counters) {
+	++counters_frames;
+	memcpy(counters_last, usart_frame, sizeof(counters_last));
+	return;
+    }
+    ++telemetry_frames;
+    memcpy(telemetry_last, usart_frame, sizeof(telemetry_last));
+}
+
+void usart_start(const uint8_t byte) {
+    usart_shift_end = cycles + usart_byte_cycles();
+    usart_received(byte);
+}
+
+void write_udr(const uint8_t value) {
+    if ((regs[R_UCSRB] & getByteWithBitSet(TXEN)) == 0 || udr_full) {
+	return; // Ignored, like the AVR does.
+    }
+    if (cycles >= usart_shift_end) {
+	usart_start(value);
+	return;
+    }
+    udr_full = true;
+    udr_buffer = value;
+    regs[R_UCSRA] &= getByteWithBitCleared(UDRE);
+}
+
+void step_usart() {
+    if (udr_full && cycles >= usart_shift_end) {
+	udr_full = false;
+	regs[R_UCSRA] |= getByteWithBitSet(UDRE);
+	usart_start(udr_buffer);
+    }
+}
+
+struct Vector {
+    void (*handler)();
+    Reg flag_reg;
+    uint8_t flag;
+    Reg enable_reg;
+    uint8_t enable;
+    bool cleared_on_entry = true; // TWINT stays set until the handler writes it.
+};
+
+// In ATmega8 priority order. Only flags the model sets are listed.
+const Vector vectors[] = {
+    {TIMER2_COMP_vect, R_TIFR, OCF2, R_TIMSK, OCIE2},
+    {TIMER2_OVF_vect, R_TIFR, TOV2, R_TIMSK, TOIE2},
+    {TIMER1_CAPT_vect, R_TIFR, ICF1, R_TIMSK, TICIE1},
+    {TIMER1_COMPA_vect, R_TIFR, OCF1A, R_TIMSK, OCIE1A},
+    {TIMER1_COMPB_vect, R_TIFR, OCF1B, R_TIMSK, OCIE1B},
+    {TIMER1_OVF_vect, R_TIFR, TOV1, R_TIMSK, TOIE1},
+    {TIMER0_OVF_vect, R_TIFR, TOV0, R_TIMSK, TOIE0},
+    // UDRE is a level, not a flag: the handler clears it by filling UDR, or UDRIE.
+    {USART_UDRE_vect, R_UCSRA, UDRE, R_UCSRB, UDRIE, false},
+    {ANA_COMP_vect, R_ACSR, ACI, R_ACSR, ACIE},
+    {TWI_vect, R_TWCR, TWINT, R_TWCR, TWIE, false},
+};
+constexpr uint8_t VECTOR_COUNT = sizeof(vectors) / sizeof(vectors[0]);
+
+void report() {
+    printf("seconds=%.6f\n", cycles / F_CLK);
+    printf("commutations=%llu\n", (unsigned long long) commutations);
+    printf("erpm=%.0f\n", fabs(omega) * 60.0 / TWO_PI);
+    printf("max_erpm=%.0f\n", max_omega * 60.0 / TWO_PI);
+    printf("shoot_through_samples=%llu\n", (unsigned long long) shoot_through);
+    if (delays != 0) {
+	printf("zc_to_commutation_deg_avg=%.2f\n", delay_sum / delays);
+	printf("zc_to_commutation_deg_min=%.2f\n", delay_min);
+	printf("zc_to_commutation_deg_max=%.2f\n", delay_max);
+    }
+    static const char* const names[VECTOR_COUNT] = {
+	"TIMER2_COMP", "TIMER2_OVF", "TIMER1_CAPT", "TIMER1_COMPA",
+	"TIMER1_COMPB", "TIMER1_OVF", "TIMER0_OVF", "USART_UDRE", "ANA_COMP", "TWI",
+    };
+    if (twi_reads != 0) {
+	printf("twi_reads=%llu\n", (unsigned long long) twi_reads);
+	printf("twi_status=0x%02x\n", twi_status[0]);
+	printf("twi_goodies=%u\n", twi_status[1]);
+	printf("twi_timing=%u\n", twi_status[2] | twi_status[3] << 8 | twi_status[4] << 16);
+    }
+    if (usart_bytes != 0) {
+	const uint8_t* const t = telemetry_last;
+	printf("usart_bytes=%llu\n", (unsigned long long) usart_bytes);
+	printf("telemetry_frames=%llu\n", (unsigned long long) telemetry_frames);
+	printf("telemetry_bad_frames=%llu\n", (unsigned long long) telemetry_bad_frames);
+	printf("telemetry_state=%u\n", t[1]);
+	printf("telemetry_goodies=%u\n", t[2]);
+	const uint32_t telemetry_timing = t[3] | t[4] << 8 | t[5] << 16;
+	printf("telemetry_timing=%u\n", telemetry_timing);
+	// timing_to_erpm(), 0 for not running.
+	printf("telemetry_erpm=%u\n", telemetry_timing == 0 ? 0u : 60u * 16000000u / 3u / telemetry_timing);
+	printf("telemetry_sys_control=%u\n", t[6] | t[7] << 8);
+	printf("telemetry_timing_duty=%u\n", t[8] | t[9] << 8);
+    }
+    if (counters_frames != 0) {
+	// perf_counters.h order.
+	static const char* const counter_names[] = {
+	    "demag_timeouts", "zc_timeouts", "startup_timeouts", "power_skips",
+	    "timing_max_clamps", "governor_clamps", "starts", "start_failures",
+	};
+	printf("counters_frames=%llu\n", (unsigned long long) counters_frames);
+	for (uint8_t i = 0; i < 8; ++i) {
+	    printf("perf_%s=%u\n", counter_names[i], counters_last[1 + i]);
+	}
+	const uint32_t min_timing = counters_last[9] | counters_last[10] << 8 | counters_last[11] << 16;
+	printf("perf_min_timing=%u\n", min_timing);
+	// timing_to_erpm(), 0xFFFFFF for no run yet.
+	printf("perf_max_erpm=%u\n", min_timing == 0xFFFFFFu ? 0u : 60u * 16000000u / 3u / min_timing);
+    }
+    if (trace_dumps != 0) {
+	// The last dump, oldest record first: delta ticks/events/goodies.
+	printf("trace_dumps=%llu\n", (unsigned long long) trace_dumps);
+	printf("trace_last=");
+	for (uint16_t i = 0; i < trace_last[1]; ++i) {
+	    const uint8_t* const record = &trace_last[2 + 4 * i];
+	    printf("%s%u/0x%02x/%u", i == 0 ? "" : ",", record[0] | record[1] << 8, record[2], record[3]);
+	}
+	printf("\n");
+    }
+    for (uint8_t i = 0; i < VECTOR_COUNT; ++i) {
+	printf("isr_%s=%llu\n", names[i], (unsigned long long) isr_counts[i]);
+    }
+    fflush(stdout);
+}
+
+void dispatch() {
+    if (!interrupts_enabled || in_isr) {
+	return;
+    }
+    for (uint8_t i = 0; i < VECTOR_COUNT; ++i) {
+	const Vector& v = vectors[i];
+	if ((regs[v.flag_reg] & getByteWithBitSet(v.flag)) == 0
+	    || (regs[v.enable_reg] & getByteWithBitSet(v.enable)) == 0
+	    || v.handler == nullptr) {
+	    continue;
+	}
+	// The flag is cleared by hardware on entry, and I is cleared until reti.
+	if (v.cleared_on_entry) {
+	    regs[v.flag_reg] &= getByteWithBitCleared(v.flag);
+	}
+	++isr_counts[i];
+	in_isr = true;
+	interrupts_enabled = false;
+	v.handler();
+	in_isr = false;
+	interrupts_enabled = true;
+	// The timers keep counting through the entry and exit overhead.
+	cycles += ISR_CYCLES;
+	tick_timers(ISR_CYCLES);
+	step_rc_puls(ISR_CYCLES);
+	// Restart from the highest priority, like the AVR after reti.
+	i = 0xFF;
+    }
+}
+
+void advance(uint64_t n) {
+    while (n != 0) {
+	const uint64_t step = n < MAX_STEP_CYCLES ? n : MAX_STEP_CYCLES;
+	cycles += step;
+	n -= step;
+	tick_timers(step);
+	step_motor(step);
+	step_rc_puls(step);
+	step_twi();
+	step_usart();
+	if (cycles >= end_cycles) {
+	    report();
+	    exit(0);
+	}
+	dispatch();
+    }
+}
+
+}
+
+uint8_t read(const Reg reg) {
+    advance(REG_ACCESS_CYCLES);
+    return regs[reg];
+}
+
+void write(const Reg reg, const uint8_t value) {
+    advance(REG_ACCESS_CYCLES);
+    switch (reg) {
+    case R_TIFR:
+	// Flags are cleared by writing a one.
+	regs[reg] &= ~value;
+	return;
+    case R_ACSR:
+	// ACO is read only, ACI is cleared by writing a one.
+	regs[reg] = (value & getByteWithBitCleared(ACO) & getByteWithBitCleared(ACI))
+	    | (regs[reg] & getByteWithBitSet(ACO))
+	    | (regs[reg] & getByteWithBitSet(ACI) & ~value);
+	return;
+    case R_TWCR:
+	// TWINT is cleared by writing a one.
+	regs[reg] = (value & getByteWithBitCleared(TWINT))
+	    | (regs[reg] & getByteWithBitSet(TWINT) & ~value);
+	return;
+    case R_UDR:
+	write_udr(value);
+	return;
+    case R_UCSRA:
+	// UDRE is read only, TXC cleared by writing a one isn't modelled.
+	regs[reg] = (value & getByteWithBitCleared(UDRE)) | (regs[reg] & getByteWithBitSet(UDRE));
+	return;
+    case R_OCR2:
+	ocr2_buffer = value;
+	if ((regs[R_TCCR2] & getByteWithBitSet(WGM20)) == 0) {
+	    regs[reg] = value;
+	}
+	return;
+    default:
+	regs[reg] = value;
+    }
+    if (reg == R_PORTB || reg == R_PORTD || reg == R_DDRB || reg == R_DDRD) {
+	Drive drive[3];
+	phase_drives(drive);
+	track_commutation(drive);
+    }
+}
+
+uint16_t read16(const Reg reg) {
+    advance(REG_ACCESS_CYCLES * 2);
+    switch (reg) {
+    case R_TCNT1:
+	return tcnt1;
+    case R_OCR1A:
+	return ocr1a;
+    case R_OCR1B:
+	return ocr1b;
+    case R_ICR1:
+	return icr1;
+    default:
+	return regs[reg];
+    }
+}
+
+void write16(const Reg reg, const uint16_t value) {
+    advance(REG_ACCESS_CYCLES * 2);
+    switch (reg) {
+    case R_TCNT1:
+	tcnt1 = value;
+	return;
+    case R_OCR1A:
+	ocr1a = value;
+	return;
+    case R_OCR1B:
+	ocr1b = value;
+	return;
+    case R_ICR1:
+	icr1 = value;
+	return;
+    default:
+	regs[reg] = value;
+    }
+}
+
+void disable_interrupts() {
+    interrupts_enabled = false;
+}
+
+void enable_interrupts() {
+    if (in_isr) {
+	// Nested interrupts aren't modelled, the ISR's own sei() is a no-op.
+	return;
+    }
+    interrupts_enabled = true;
+    dispatch();
+}
+
+void poll() {
+    advance(POLL_CYCLES);
+}
+
+void delay_cycles(const uint64_t n) {
+    advance(n);
+}
+
+}
+
+namespace {
+
+void usage(const char* name) {
+    fprintf(stderr,
+	    "usage: %s [--seconds=S] [--voltage=V] [--resistance=OHM] [--ke=V_PER_RAD_S]\n"
+	    "          [--inertia=J] [--friction=B] [--drag=D] [--angle=DEG] [--noise=V]\n"
+	    "          [--rc-puls=US] [--rc-arm=US] [--rc-hz=HZ] [--dshot=THROTTLE]\n"
+	    "          [--dshot-kbit=KBIT] [--twi=THROTTLE] [--twi-motor=N] [--trace]\n"
+	    "Runs the firmware against a simulated ATmega8 and motor, then prints key=value\n"
+	    "statistics. --trace prints commutation,time_us,high,low,erpm,zc_to_commutation_deg.\n"
+	    "--rc-puls sends RC pulses on ICP1 (RC_PULS), --rc-arm long for the first 1.5s to\n"
+	    "arm, 1000us and 50Hz by default. --dshot sends DShot frames at --rc-hz instead\n"
+	    "(DSHOT), throttle 0 for the first 1.5s. --twi writes an 11 bit throttle to motor N\n"
+	    "and reads its status at --rc-hz (TWI_SLAVE), 0 for the first 1.5s.\n",
+	    name);
+}
+
+bool parse(const char* arg, const char* name, double& value) {
+    const size_t len = strlen(name);
+    if (strncmp(arg, name, len) != 0 || arg[len] != '=') {
+	return false;
+    }
+    value = atof(arg + len + 1);
+    return true;
+}
+
+}
+
+int main(int argc, char** argv) {
+    sim::Options& o = sim::options;
+    for (int i = 1; i < argc; ++i) {
+	const char* arg = argv[i];
+	if (strcmp(arg, "--trace") == 0) {
+	    o.trace = true;
+	    continue;
+	}
+	if (parse(arg, "--seconds", o.seconds) || parse(arg, "--voltage", o.voltage)
+	    || parse(arg, "--resistance", o.resistance) || parse(arg, "--ke", o.ke)
+	    || parse(arg, "--inertia", o.inertia) || parse(arg, "--friction", o.friction)
+	    || parse(arg, "--drag", o.drag) || parse(arg, "--angle", o.angle)
+	    || parse(arg, "--noise", o.noise) || parse(arg, "--rc-puls", o.rc_puls)
+	    || parse(arg, "--rc-arm", o.rc_arm) || parse(arg, "--rc-hz", o.rc_hz)
+	    || parse(arg, "--dshot", o.dshot) || parse(arg, "--dshot-kbit", o.dshot_kbit)
+	    || parse(arg, "--twi", o.twi) || parse(arg, "--twi-motor", o.twi_motor)) {
+	    continue;
+	}
+	usage(argv[0]);
+	return 2;
+    }
+    sim::theta = o.angle * sim::TWO_PI / 360.0;
+    sim::end_cycles = o.seconds * sim::F_CLK;
+    sim::regs[sim::R_UCSRA] = getByteWithBitSet(UDRE);
+    firmware_main();
+    sim::report();
+    return 0;
+}
@@ -0,0 +1,68 @@
+#include <stdint.h>
+
+#ifndef HOST_SIM_H
+#define HOST_SIM_H
+
+////////////////////////////////////////////////////////////////////////////////////////
+// Host simulation of the ATmega8 and the motor, so the firmware runs as a Linux      //
+// executable (make host). The firmware is compiled unmodified against the headers   //
+// in host/avr and host/util, which route every register access through read/write  //
+// below.									      //
+// 										      //
+// Time only moves when the firmware touches a register, calls busyWaitPoll(), or     //
+// delays. Each of those advances the clock, ticks Timer0/1/2, steps the motor, and   //
+// then runs any ISR that is enabled, pending, and allowed by the I flag, in the      //
+// ATmega8 vector priority order.						      //
+// SRAM is free and never a point where an ISR can run, so moving state between SRAM  //
+// and a register, like the IoFlag bits in HOT_FLAGS (EEDR), changes the simulated    //
+// interleaving and the run's numbers, without any change in the firmware's logic.    //
+////////////////////////////////////////////////////////////////////////////////////////
+
+namespace sim {
+
+enum Reg : uint8_t {
+    R_PINB, R_DDRB, R_PORTB,
+    R_PINC, R_DDRC, R_PORTC,
+    R_PIND, R_DDRD, R_PORTD,
+    R_TCCR0, R_TCNT0,
+    R_TCCR1A, R_TCCR1B, R_TCNT1, R_OCR1A, R_OCR1B, R_ICR1,
+    R_TCCR2, R_TCNT2, R_OCR2,
+    R_TIFR, R_TIMSK,
+    R_ACSR, R_SFIOR, R_ADCSRA, R_ADMUX,
+    R_MCUCR, R_GICR, R_GIFR,
+    R_EEDR,
+    R_UDR, R_UCSRA, R_UCSRB, R_UCSRC, R_UBRRL, R_UBRRH,
+    R_TWBR, R_TWSR, R_TWAR, R_TWDR, R_TWCR,
+    R_SREG, R_SPL, R_SPH,
+    REG_COUNT
+};
+
+uint8_t read(Reg reg);
+void write(Reg reg, uint8_t value);
+uint16_t read16(Reg reg);
+void write16(Reg reg, uint16_t value);
+
+void disable_interrupts();
+void enable_interrupts();
+// One iteration of a busy wait loop that doesn't otherwise touch a register.
+void poll();
+void delay_cycles(uint64_t cycles);
+
+// Registers as the firmware sees them: every conversion is a read, every assignment a write.
+struct Reg8 {
+    const Reg reg;
+    operator uint8_t() const { return read(reg); }
+    Reg8& operator=(const uint8_t value) { write(reg, value); return *this; }
+    Reg8& operator=(const Reg8& other) { return *this = (uint8_t) other; }
+};
+
+struct Reg16 {
+    const Reg reg;
+    operator uint16_t() const { return read16(reg); }
+    Reg16& operator=(const uint16_t value) { write16(reg, value); return *this; }
+    Reg16& operator=(const Reg16& other) { return *this = (uint16_t) other; }
+};
+
+}
+
+#endif
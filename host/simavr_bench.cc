@@ -0,0 +1,476 @@
+#include <cxxabi.h>
+#include <fcntl.h>
+#include <gelf.h>
+#include <libelf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "sim_io.h"
+#include "sim_vcd_file.h"
+#include "avr_acomp.h"
+#include "avr_ioport.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+// Cycle counts for the ISRs and hot path functions, on simavr (make bench).	      //
+// 										      //
+// Loads the benchmark ELF (built with BENCHMARK=1, see esc_config.h) into an atmega8 //
+// at 16 MHz and single steps it. A probe opens when the PC reaches a vector slot or  //
+// a function's first instruction, and closes once SP rises above its value at entry,//
+// i.e. after the reti/ret. ISR time is subtracted from whatever it interrupted, so   //
+// every row is the cost of that code alone. The interrupt response (4 cycles) is not //
+// counted, the rjmp in the vector slot is.					      //
+// 										      //
+// Stimulus: a scripted motor. Each commutation (read off the FET pins) schedules a   //
+// zero crossing on the floating phase half a commutation period later, for a target  //
+// eRPM that steps through --erpm over the run. The floating phase is driven to the   //
+// far side of the neutral (AIN0) until then and to the near side after, so the       //
+// firmware locks on and runs at roughly the target speed.			      //
+// 										      //
+// TIMER2_OVF_vect is split by the PWM state at entry, read from PWM_STATUS, one      //
+// row per software PWM handler, for either PWM dispatch (PWM_JUMP_TABLE 0 or 1).     //
+// 										      //
+// Prints one tab separated row per probe on stdout: name kind calls min avg max.    //
+// The summary on stderr includes the most stack the firmware used (RAMEND - min SP). //
+// --vcd writes the FET pins and the debug marker pins (DEBUG_MARKERS, see atmel.h)   //
+// to a VCD file, for a logic analyzer view of the same run.			      //
+////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+constexpr uint32_t F_CLK = 16000000;
+constexpr uint32_t VBAT_MV = 12000;
+constexpr uint32_t NEUTRAL_MV = VBAT_MV / 2;
+constexpr uint32_t BEMF_MV = 500;
+constexpr uint8_t NO_PHASE = 0xFF;
+
+// afro_nfet pinout, see atmel.h. nFETs are active high, pFETs active low.
+constexpr uint16_t PORTB_ADDR = 0x38;
+constexpr uint16_t PORTD_ADDR = 0x32;
+struct FetPin { uint16_t port; uint8_t idx; };
+constexpr FetPin N_FETS[3] = {{PORTD_ADDR, 3}, {PORTD_ADDR, 4}, {PORTD_ADDR, 5}};
+constexpr FetPin P_FETS[3] = {{PORTD_ADDR, 2}, {PORTB_ADDR, 2}, {PORTB_ADDR, 1}};
+// Comparator inputs per phase, see the mux setup in esc_config.h: A and B through the
+// ADC mux, C on AIN1.
+constexpr int PHASE_IRQ[3] = {ACOMP_IRQ_ADC0, ACOMP_IRQ_ADC1, ACOMP_IRQ_AIN1};
+
+const char* const VECTOR_NAMES[] = {
+    "RESET", "INT0_vect", "INT1_vect", "TIMER2_COMP_vect", "TIMER2_OVF_vect",
+    "TIMER1_CAPT_vect", "TIMER1_COMPA_vect", "TIMER1_COMPB_vect", "TIMER1_OVF_vect",
+    "TIMER0_OVF_vect", "SPI_STC_vect", "USART_RXC_vect", "USART_UDRE_vect",
+    "USART_TXC_vect", "ADC_vect", "EE_RDY_vect", "ANA_COMP_vect", "TWI_vect", "SPM_RDY_vect",
+};
+constexpr uint8_t VECTOR_COUNT = sizeof(VECTOR_NAMES) / sizeof(VECTOR_NAMES[0]);
+
+// Functions timed on their own, when the ELF has them out of line.
+const char* const FUNCTIONS[] = {
+    "update_timing", "update_timing1", "set_ocr1a_abs_slow", "update_timing_add_degrees",
+    "set_new_duty_l",
+};
+
+struct Options {
+    const char* elf = "SimonKpp_bench.elf";
+    double seconds = 4.0;
+    std::vector<uint32_t> erpm = {10000, 30000, 60000};
+    const char* vcd = nullptr;
+} options;
+
+struct Probe {
+    std::string name;
+    const char* kind;
+    uint32_t addr;
+    uint64_t calls = 0;
+    uint64_t min = UINT64_MAX;
+    uint64_t max = 0;
+    uint64_t total = 0;
+};
+
+struct Frame {
+    size_t probe;
+    uint16_t sp;
+    avr_cycle_count_t start;
+    uint64_t isr_at_start;
+};
+
+// Software PWM states, in PWM_STATUS_ENUM order (globals.h), and their PWM_JUMP_TABLE
+// entry points, whose word address low byte PWM_STATUS holds in that mode.
+const char* const PWM_STATES[] = {
+    "PWM_NOP", "PWM_OFF", "PWM_ON", "PWM_ON_FAST", "PWM_ON_FAST_HIGH", "PWM_ON_HIGH",
+};
+const char* const PWM_ENTRIES[] = {
+    "pwm_nop_entry", "pwm_off_entry", "pwm_on_entry", "pwm_on_fast_entry",
+    "pwm_on_fast_high_entry", "pwm_on_high_entry",
+};
+constexpr uint8_t PWM_STATE_COUNT = sizeof(PWM_STATES) / sizeof(PWM_STATES[0]);
+constexpr uint8_t TIMER2_COMP_VECTOR = 3;
+constexpr uint8_t TIMER2_OVF_VECTOR = 4;
+// The data space in an AVR ELF starts here.
+constexpr uint32_t ELF_DATA_OFFSET = 0x800000;
+
+std::vector<Probe> probes;
+// Software PWM only: TIMER2_OVF_vect's probe, and one probe per PWM state it splits into.
+size_t pwm_vector_probe = SIZE_MAX;
+size_t pwm_state_probes[PWM_STATE_COUNT];
+uint16_t pwm_status_addr = UINT16_MAX; // PWM_STATUS's, from the ELF.
+bool pwm_jump_table = false;
+uint8_t pwm_entry_lo8[PWM_STATE_COUNT];
+// Probe index + 1 per flash word, 0 for none.
+std::vector<uint16_t> probe_at;
+std::vector<Frame> frames;
+uint64_t isr_cycles = 0;
+
+avr_t* avr = nullptr;
+uint8_t high_phase = NO_PHASE;
+uint8_t low_phase = NO_PHASE;
+avr_cycle_count_t zc_cycle = 0;
+uint8_t floating_phase = NO_PHASE;
+bool rising = false;
+bool zc_done = true;
+uint64_t commutations = 0;
+// Lowest SP seen, for the stack high watermark.
+uint16_t min_sp = UINT16_MAX;
+
+std::string base_name(const char* symbol) {
+    int status = 0;
+    char* demangled = abi::__cxa_demangle(symbol, nullptr, nullptr, &status);
+    std::string name = status == 0 ? demangled : symbol;
+    free(demangled);
+    return name.substr(0, name.find_first_of("(."));
+}
+
+void add_probe(const std::string& name, const char* kind, const uint32_t addr) {
+    probes.push_back(Probe{name, kind, addr});
+    if (addr / 2 < probe_at.size()) {
+	probe_at[addr / 2] = probes.size();
+    }
+}
+
+bool load_probes(const char* path) {
+    elf_version(EV_CURRENT);
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+	return false;
+    }
+    Elf* elf = elf_begin(fd, ELF_C_READ, nullptr);
+    std::vector<bool> vectors(VECTOR_COUNT);
+    std::vector<uint32_t> functions(sizeof(FUNCTIONS) / sizeof(FUNCTIONS[0]), UINT32_MAX);
+    Elf_Scn* scn = nullptr;
+    while (elf != nullptr && (scn = elf_nextscn(elf, scn)) != nullptr) {
+	GElf_Shdr shdr;
+	if (gelf_getshdr(scn, &shdr) == nullptr || shdr.sh_type != SHT_SYMTAB) {
+	    continue;
+	}
+	Elf_Data* data = elf_getdata(scn, nullptr);
+	for (size_t i = 0; i < shdr.sh_size / shdr.sh_entsize; ++i) {
+	    GElf_Sym sym;
+	    gelf_getsym(data, i, &sym);
+	    const std::string name = base_name(elf_strptr(elf, shdr.sh_link, sym.st_name));
+	    if (name == "PWM_STATUS") {
+		pwm_status_addr = sym.st_value - ELF_DATA_OFFSET;
+	    }
+	    // The entries are asm labels, with no symbol type.
+	    for (uint8_t state = 0; state < PWM_STATE_COUNT; ++state) {
+		if (name == PWM_ENTRIES[state]) {
+		    pwm_jump_table = true;
+		    pwm_entry_lo8[state] = sym.st_value / 2;
+		}
+	    }
+	    if (GELF_ST_TYPE(sym.st_info) != STT_FUNC) {
+		continue;
+	    }
+	    unsigned vector = 0;
+	    if (sscanf(name.c_str(), "__vector_%u", &vector) == 1 && vector < VECTOR_COUNT) {
+		vectors[vector] = true;
+	    }
+	    for (size_t f = 0; f < functions.size(); ++f) {
+		if (name == FUNCTIONS[f]) {
+		    functions[f] = sym.st_value;
+		}
+	    }
+	}
+    }
+    if (elf != nullptr) {
+	elf_end(elf);
+    }
+    close(fd);
+
+    // One rjmp per vector slot on the ATmega8.
+    for (uint8_t vector = 1; vector < VECTOR_COUNT; ++vector) {
+	if (vectors[vector]) {
+	    add_probe(VECTOR_NAMES[vector], "isr", vector * 2);
+	}
+    }
+    // TIMER2_COMPARE_PWM has no PWM states to split by.
+    if (vectors[TIMER2_OVF_VECTOR] && !vectors[TIMER2_COMP_VECTOR] && pwm_status_addr != UINT16_MAX) {
+	pwm_vector_probe = probe_at[TIMER2_OVF_VECTOR] - 1;
+	for (uint8_t state = 0; state < PWM_STATE_COUNT; ++state) {
+	    pwm_state_probes[state] = probes.size();
+	    probes.push_back(Probe{std::string(VECTOR_NAMES[TIMER2_OVF_VECTOR]) + " " + PWM_STATES[state],
+				   "isr", UINT32_MAX});
+	}
+    }
+    for (size_t f = 0; f < functions.size(); ++f) {
+	if (functions[f] == UINT32_MAX) {
+	    fprintf(stderr, "%s is not in %s (inlined? build with BENCHMARK=1)\n", FUNCTIONS[f], path);
+	    add_probe(FUNCTIONS[f], "function", UINT32_MAX);
+	    continue;
+	}
+	add_probe(FUNCTIONS[f], "function", functions[f]);
+    }
+    return true;
+}
+
+uint16_t sp() {
+    return avr->data[R_SPL] | (avr->data[R_SPH] << 8);
+}
+
+bool bit(const uint16_t addr, const uint8_t idx) {
+    return (avr->data[addr] >> idx) & 1u;
+}
+
+bool fet_on(const FetPin& pin, const bool active_high) {
+    // DDR is the register before PORT. An input pin leaves its FET off.
+    return bit(pin.port - 1, pin.idx) && bit(pin.port, pin.idx) == active_high;
+}
+
+void set_mv(const int irq, const uint32_t mv) {
+    avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_ACOMP_GETIRQ, irq), mv);
+}
+
+void drive_comparator() {
+    set_mv(ACOMP_IRQ_AIN0, NEUTRAL_MV);
+    for (uint8_t phase = 0; phase < 3; ++phase) {
+	uint32_t mv = NEUTRAL_MV;
+	if (phase == high_phase) {
+	    mv = VBAT_MV;
+	} else if (phase == low_phase) {
+	    mv = 0;
+	} else if (phase == floating_phase) {
+	    // Rising: below the neutral until the zero crossing, above after. Falling: the reverse.
+	    mv = (rising == zc_done) ? NEUTRAL_MV + BEMF_MV : NEUTRAL_MV - BEMF_MV;
+	}
+	set_mv(PHASE_IRQ[phase], mv);
+    }
+}
+
+uint32_t target_erpm() {
+    const double t = double(avr->cycle) / F_CLK;
+    size_t step = t * options.erpm.size() / options.seconds;
+    if (step >= options.erpm.size()) {
+	step = options.erpm.size() - 1;
+    }
+    return options.erpm[step];
+}
+
+void step_motor() {
+    uint8_t high = high_phase;
+    uint8_t low = low_phase;
+    for (uint8_t phase = 0; phase < 3; ++phase) {
+	if (fet_on(P_FETS[phase], false)) {
+	    high = phase;
+	}
+	// Low side PWM: all nFETs off during the off period is not a commutation.
+	if (fet_on(N_FETS[phase], true)) {
+	    low = phase;
+	}
+    }
+    if (high != high_phase || low != low_phase) {
+	const uint8_t last_low = low_phase;
+	high_phase = high;
+	low_phase = low;
+	if (high != NO_PHASE && low != NO_PHASE && high != low) {
+	    ++commutations;
+	    floating_phase = 3 - high - low;
+	    // A phase that was pulled low and is now floating rises back through the neutral.
+	    rising = floating_phase == last_low;
+	    // Six commutations per electrical revolution, zero crossing half way.
+	    zc_cycle = avr->cycle + uint64_t(F_CLK) * 60 / 6 / target_erpm() / 2;
+	    zc_done = false;
+	}
+	drive_comparator();
+    }
+    if (!zc_done && avr->cycle >= zc_cycle) {
+	zc_done = true;
+	drive_comparator();
+    }
+}
+
+// TIMER2_OVF_vect's probe for the PWM state it is about to dispatch.
+size_t pwm_state_probe() {
+    const uint8_t status = avr->data[pwm_status_addr];
+    for (uint8_t state = 0; state < PWM_STATE_COUNT; ++state) {
+	if (pwm_jump_table ? status == pwm_entry_lo8[state] : status == state) {
+	    return pwm_state_probes[state];
+	}
+    }
+    return pwm_vector_probe;
+}
+
+void close_frames() {
+    const uint16_t stack = sp();
+    while (!frames.empty() && stack > frames.back().sp) {
+	const Frame frame = frames.back();
+	frames.pop_back();
+	Probe& probe = probes[frame.probe];
+	const uint64_t nested = isr_cycles - frame.isr_at_start;
+	const uint64_t spent = avr->cycle - frame.start - nested;
+	if (strcmp(probe.kind, "isr") == 0) {
+	    isr_cycles += spent;
+	}
+	++probe.calls;
+	probe.total += spent;
+	probe.min = spent < probe.min ? spent : probe.min;
+	probe.max = spent > probe.max ? spent : probe.max;
+    }
+}
+
+void open_frame() {
+    const uint32_t word = avr->pc / 2;
+    if (word >= probe_at.size() || probe_at[word] == 0) {
+	return;
+    }
+    size_t probe = probe_at[word] - 1;
+    if (probe == pwm_vector_probe) {
+	probe = pwm_state_probe();
+    }
+    const uint16_t stack = sp();
+    // A loop branching back to the first instruction is not a new call.
+    if (!frames.empty() && frames.back().probe == probe && frames.back().sp == stack) {
+	return;
+    }
+    frames.push_back(Frame{probe, stack, avr->cycle, isr_cycles});
+}
+
+void report() {
+    printf("name\tkind\tcalls\tmin\tavg\tmax\n");
+    for (const Probe& probe : probes) {
+	if (probe.calls == 0) {
+	    printf("%s\t%s\t0\t-\t-\t-\n", probe.name.c_str(), probe.kind);
+	    continue;
+	}
+	printf("%s\t%s\t%llu\t%llu\t%.1f\t%llu\n", probe.name.c_str(), probe.kind,
+	       (unsigned long long) probe.calls, (unsigned long long) probe.min,
+	       double(probe.total) / probe.calls, (unsigned long long) probe.max);
+    }
+    fprintf(stderr, "seconds=%f commutations=%llu stack_max_bytes=%u\n", double(avr->cycle) / F_CLK,
+	    (unsigned long long) commutations, unsigned(avr->ramend - min_sp));
+}
+
+// The FETs, then the debug marker pins, see atmel.h.
+struct VcdPin { char port; uint8_t idx; const char* name; };
+constexpr VcdPin VCD_PINS[] = {
+    {'D', 2, "ApFET"}, {'B', 2, "BpFET"}, {'B', 1, "CpFET"},
+    {'D', 3, "AnFET"}, {'D', 4, "BnFET"}, {'D', 5, "CnFET"},
+    {'B', 3, "mark_zc"}, {'B', 4, "mark_sync"}, {'B', 5, "mark_commutation_demag"},
+    {'C', 4, "mark_pwm_isr"}, {'C', 5, "mark_update_timing"},
+};
+avr_vcd_t vcd;
+
+bool start_vcd(const char* file) {
+    if (avr_vcd_init(avr, file, &vcd, 100000) != 0) {
+	return false;
+    }
+    for (const VcdPin& pin : VCD_PINS) {
+	avr_irq_t* const irq = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(pin.port), IOPORT_IRQ_PIN0 + pin.idx);
+	avr_vcd_add_signal(&vcd, irq, 1, pin.name);
+    }
+    avr_vcd_start(&vcd);
+    return true;
+}
+
+void usage(const char* name) {
+    fprintf(stderr,
+	    "usage: %s [--elf=FILE] [--seconds=S] [--erpm=E1,E2,...] [--vcd=FILE]\n"
+	    "Runs the firmware on a simavr atmega8 against a scripted motor, stepping through the\n"
+	    "target eRPMs in equal parts of the run, and prints name,kind,calls,min,avg,max cycle\n"
+	    "counts for every ISR and hot path function, tab separated. --vcd also writes the FET\n"
+	    "and debug marker pins to FILE.\n",
+	    name);
+}
+
+bool parse_erpm(const char* list) {
+    options.erpm.clear();
+    for (const char* p = list; *p != '\0';) {
+	char* end = nullptr;
+	const unsigned long erpm = strtoul(p, &end, 10);
+	if (end == p || erpm == 0) {
+	    return false;
+	}
+	options.erpm.push_back(erpm);
+	p = *end == ',' ? end + 1 : end;
+    }
+    return !options.erpm.empty();
+}
+
+}
+
+int main(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+	const char* arg = argv[i];
+	if (strncmp(arg, "--elf=", 6) == 0) {
+	    options.elf = arg + 6;
+	} else if (strncmp(arg, "--seconds=", 10) == 0) {
+	    options.seconds = atof(arg + 10);
+	} else if (strncmp(arg, "--vcd=", 6) == 0) {
+	    options.vcd = arg + 6;
+	} else if (strncmp(arg, "--erpm=", 7) != 0 || !parse_erpm(arg + 7)) {
+	    usage(argv[0]);
+	    return 2;
+	}
+    }
+
+    elf_firmware_t firmware = {};
+    if (elf_read_firmware(options.elf, &firmware) != 0) {
+	fprintf(stderr, "can't load %s\n", options.elf);
+	return 1;
+    }
+    strcpy(firmware.mmcu, "atmega8");
+    firmware.frequency = F_CLK;
+    avr = avr_make_mcu_by_name(firmware.mmcu);
+    if (avr == nullptr) {
+	fprintf(stderr, "simavr has no atmega8 core\n");
+	return 1;
+    }
+    avr_init(avr);
+    avr_load_firmware(avr, &firmware);
+    if (avr_io_getirq(avr, AVR_IOCTL_ACOMP_GETIRQ, ACOMP_IRQ_AIN0) == nullptr) {
+	fprintf(stderr, "this simavr has no analog comparator for the atmega8\n");
+	return 1;
+    }
+
+    probe_at.assign((avr->flashend + 1) / 2, 0);
+    if (!load_probes(options.elf)) {
+	fprintf(stderr, "can't read symbols from %s\n", options.elf);
+	return 1;
+    }
+    drive_comparator();
+    if (options.vcd != nullptr && !start_vcd(options.vcd)) {
+	fprintf(stderr, "can't write %s\n", options.vcd);
+	return 1;
+    }
+
+    const avr_cycle_count_t end = options.seconds * F_CLK;
+    while (avr->cycle < end) {
+	close_frames();
+	open_frame();
+	const int state = avr_run(avr);
+	if (state == cpu_Done || state == cpu_Crashed) {
+	    fprintf(stderr, "cpu stopped at pc 0x%04x\n", avr->pc);
+	    break;
+	}
+	step_motor();
+	if (sp() < min_sp) {
+	    min_sp = sp();
+	}
+    }
+    if (options.vcd != nullptr) {
+	avr_vcd_stop(&vcd);
+    }
+    report();
+    return 0;
+}
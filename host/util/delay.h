@@ -0,0 +1,15 @@
+#include "../sim.h"
+
+#ifndef HOST_UTIL_DELAY_H
+#define HOST_UTIL_DELAY_H
+
+// Host stand in for <util/delay.h>, see host/sim.h.
+inline void _delay_ms(const double ms) {
+    sim::delay_cycles(ms * (F_CPU / 1000));
+}
+
+inline void _delay_us(const double us) {
+    sim::delay_cycles(us * (F_CPU / 1000000));
+}
+
+#endif
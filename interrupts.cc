@@ -1,6 +1,12 @@
 #include "globals.h"
 #include "atmel.h"
 #include "interrupts.h"
+#include "set_duty.h"
+#if DSHOT
+#include "dshot.h"
+#endif
+#include "twi.h"
+#include "telemetry.h"
 /********************************************/
 /* Timer1 Interrupts: Commutation timing.   */
 /* Timer0 Interrupts: Beep control, delays. */
@@ -19,27 +25,278 @@
 // https://www.nongnu.org/avr-libc/user-manual/group__avr__interrupts.html#gad28590624d422cdf30d626e0a506255f
 // The LEDs can be used to verify an interrupt works.
 
+#if COMMUTATE_IN_ISR && !defined(HOST_SIM)
+////////////////////////////////////////////////////////////////////////////////////////
+// COMMUTATE_IN_ISR: the compare matches once per Timer1 wrap while ocr1ax counts     //
+// down, and only the last match commutates. The indirect commutation() call makes   //
+// avr-gcc save every call clobbered register, so the vector is naked: it decrements  //
+// ocr1ax with one register and SREG saved, and only the last match rjmps on to       //
+// __vector_commutation, a signal handler of its own, the way the PWM_JUMP_TABLE      //
+// entries do. An extension tick costs 20 cycles past the vector, reti included.     //
+////////////////////////////////////////////////////////////////////////////////////////
+ISR(TIMER1_COMPA_vect, ISR_NAKED) {
+    asm volatile(
+	"push r24\n\t"
+	"in r24, __SREG__\n\t"
+	"push r24\n\t"
+	"lds r24, %[ocr1ax]\n\t"
+	"subi r24, 1\n\t" // Carry for ocr1ax == 0, the last match.
+	"sts %[ocr1ax], r24\n\t"
+	"brcs 1f\n\t"
+	"pop r24\n\t"
+	"out __SREG__, r24\n\t"
+	"pop r24\n\t"
+	"reti\n\t"
+	"1:\n\t"
+	"pop r24\n\t"
+	"out __SREG__, r24\n\t"
+	"pop r24\n\t"
+	"rjmp __vector_commutation\n\t"
+	:: [ocr1ax] "i" (&ocr1ax));
+}
+
+// The __vector prefix keeps avr-gcc from warning about a misspelled signal handler.
+ISR(__vector_commutation) {
+    oct1_pending = false; // Passed OCT1A.
+    const commutation_t commutation = scheduled_commutation;
+    if (commutation != nullptr) {
+	scheduled_commutation = nullptr;
+	commutation();
+    }
+}
+#else
 // timer1 output compare interrupt
 ISR(TIMER1_COMPA_vect) {
     if (ocr1ax < 1) {
 	oct1_pending = false; // Passed OCT1A.
+#if COMMUTATE_IN_ISR
+	const commutation_t commutation = scheduled_commutation;
+	if (commutation != nullptr) {
+	    scheduled_commutation = nullptr;
+	    commutation();
+	}
+#endif
     }
     --ocr1ax;
 }
+#endif
 
 // timer1 overflow interrupt (happens every 4096µs)
 ISR(TIMER1_OVF_vect) {
     ++tcnt1x;
+    if (UART_TELEMETRY && (tcnt1x & (TELEMETRY_PERIOD_OVERFLOWS - 1)) == 0) {
+	telemetry_due = true;
+    }
     if ( (tcnt1x & 0b1111 /* 15U */ ) == 0 ) {
 	if ( rc_timeout == 0 ) {
 	    // rc_timeout hit, increase the beacon.
 	    ++rct_boot;
 	    ++rct_beacon;
+	} else if (RC_INPUT) {
+	    // Counted back up to RCP_TOT by every valid pulse, see rc_duty_set().
+	    --rc_timeout;
 	}
     }
 }
 
+#if ZC_INTERRUPT && !ZC_CAPTURE
+// Comparator edge, armed for one edge at a time by wait_functions.cc.
+ISR(ANA_COMP_vect) {
+    zc_tcnt1 = getTCNT1x();
+    disarmComparatorInterrupt();
+    zc_edge_pending = true;
+}
+#endif
+
+#if ZC_CAPTURE
+// Comparator edge captured in ICR1 (ACIC), armed by wait_functions.cc.
+// Extends ICR1 like update_timing() did TCNT1: TIMER1_CAPT_vect outranks TIMER1_OVF_vect,
+// so an overflow after the capture is still pending in TIFR here.
+ISR(TIMER1_CAPT_vect) {
+    const uint16_t icr1 = getICR1();
+    zc_tcnt1 = extendTCNT1(icr1, tcnt1x, getTIFR());
+    zc_edge_pending = true;
+}
+#endif
+
+#if RC_PULS
+#if ZC_CAPTURE
+#error "RC_PULS times the pulses with the input capture unit, which ZC_CAPTURE routes to the comparator."
+#endif
+
+// RC pulse on ICP1. Flip-flops between the rising and falling edge, and posts the
+// length between them in Timer1 ticks, if in rc_puls_min_ticks..rc_puls_max_ticks.
+// Both edges are extended to 24 bits, so a pulse held high past a Timer1 wrap (4096us)
+// is rejected instead of wrapping into range.
+// The scaling to a duty is left to evaluate_rc(), outside the interrupt.
+ISR(TIMER1_CAPT_vect) {
+    const ticks24_t edge = extendTCNT1(getICR1(), tcnt1x, getTIFR());
+    if (isCaptureEdgeRising()) {
+	rc_puls_start = edge;
+	setCaptureEdge(false);
+    } else {
+	setCaptureEdge(true);
+	const ticks24_t puls = edge - rc_puls_start;
+	if (puls >= ticks24_t(rc_puls_min_ticks, 0) && puls <= ticks24_t(rc_puls_max_ticks, 0)) {
+	    post_rc_puls(puls.low16());
+	}
+    }
+}
+#endif
+
+#if DSHOT
+#if RC_PULS || ZC_CAPTURE
+#error "DSHOT reads the RC input with the input capture unit, which RC_PULS and ZC_CAPTURE also use."
+#endif
+#if COMMUTATE_IN_ISR || TIMER2_COMPARE_PWM
+#error "DSHOT holds interrupts off for a whole frame, see esc_config.h, which undoes COMMUTATE_IN_ISR and TIMER2_COMPARE_PWM."
+#endif
+
+// The first rising edge of a DShot frame, see dshot.h.
+ISR(TIMER1_CAPT_vect) {
+    dshot_receive_frame(getICR1());
+}
+#endif
+
+#if TWI_SLAVE
+#if RC_PULS || DSHOT
+#error "TWI_SLAVE is a throttle input of its own, pick one of RC_PULS, DSHOT and TWI_SLAVE."
+#endif
+
+// TWI bus event, see twi.h. Masks itself, so TIMER2_OVF_vect can run during the handler.
+ISR(TWI_vect) {
+    TWCR = TWI_HOLD;
+    sei();
+    const uint8_t twcr = twi_slave_event(TWSR & 0xF8u);
+    cli();
+    TWCR = twcr;
+}
+#endif
+
+#if UART_TELEMETRY
+// Next telemetry byte, until the ring buffer is empty, see telemetry.h.
+ISR(USART_UDRE_vect) {
+    uint8_t tail = telemetry_tail;
+    UDR = telemetry_buffer[tail];
+    tail = (tail + 1) & (TELEMETRY_BUFFER_BYTES - 1);
+    telemetry_tail = tail;
+    if (tail == telemetry_head) {
+	UCSRB = UCSRB & getByteWithBitCleared(UDRIE);
+    }
+}
+#endif
+
+#if TIMER2_COMPARE_PWM
+#if PWM_JUMP_TABLE
+#error "PWM_JUMP_TABLE dispatches the software PWM states, it does not apply to TIMER2_COMPARE_PWM."
+#endif
+
+ISR(TIMER2_OVF_vect) {
+    pwmIsrMarkOn();
+    pwm_compare_on();
+    pwmIsrMarkOff();
+}
+
+ISR(TIMER2_COMP_vect) {
+    pwmIsrMarkOn();
+    pwm_compare_off();
+    pwmIsrMarkOff();
+}
+#elif PWM_JUMP_TABLE
+////////////////////////////////////////////////////////////////////////////////////////
+// SimonK style PWM dispatch, see PWM_JUMP_TABLE in globals.h.			      //
+// The vector pushes Z, loads ZL from PWM_STATUS and ZH from a constant, and ijmps    //
+// into the entry block below. None of those instructions touch SREG.		      //
+// Each entry pops Z back and rjmps to a signal handler, which then looks to the      //
+// hardware like it was entered straight from the vector, and only saves the	      //
+// registers that one handler uses, instead of all the registers any case of the      //
+// switch uses.									      //
+// 										      //
+// The block is 18 words, aligned to 32 words, so it can never cross a 256 word page, //
+// which is what lets every entry share the same ZH.				      //
+// 										      //
+// The dispatch is fixed asm, so its cost is the same for every status: push, push,  //
+// lds, ldi, ijmp (9) + pop, pop, rjmp (6) = 15 cycles to the handler's first	      //
+// instruction, or 9 + pop, pop, reti (8) = 17 in all for PWM_NOP. What the switch    //
+// costs depends on the code avr-gcc makes of it, so compare the two per handler with //
+// make bench, which splits TIMER2_OVF_vect by PWM state, once plain and once with    //
+// BENCH_FLAGS=-DPWM_JUMP_TABLE=1.						      //
+////////////////////////////////////////////////////////////////////////////////////////
+asm(
+    ".text\n"
+    ".balign 64\n"
+    ".global pwm_nop_entry\n"
+    "pwm_nop_entry:\n"
+    "	pop r31\n"
+    "	pop r30\n"
+    "	reti\n"
+    ".global pwm_off_entry\n"
+    "pwm_off_entry:\n"
+    "	pop r31\n"
+    "	pop r30\n"
+    "	rjmp __vector_pwm_off\n"
+    ".global pwm_on_entry\n"
+    "pwm_on_entry:\n"
+    "	pop r31\n"
+    "	pop r30\n"
+    "	rjmp __vector_pwm_on\n"
+    ".global pwm_on_fast_entry\n"
+    "pwm_on_fast_entry:\n"
+    "	pop r31\n"
+    "	pop r30\n"
+    "	rjmp __vector_pwm_on_fast\n"
+    ".global pwm_on_fast_high_entry\n"
+    "pwm_on_fast_high_entry:\n"
+    "	pop r31\n"
+    "	pop r30\n"
+    "	rjmp __vector_pwm_on_fast_high\n"
+    ".global pwm_on_high_entry\n"
+    "pwm_on_high_entry:\n"
+    "	pop r31\n"
+    "	pop r30\n"
+    "	rjmp __vector_pwm_on_high\n"
+    );
+
+// The __vector prefix keeps avr-gcc from warning about a misspelled signal handler.
+// PWM_NOP returns from its entry, unmarked.
+ISR(__vector_pwm_off) {
+    pwmIsrMarkOn();
+    pwm_off();
+    pwmIsrMarkOff();
+}
+ISR(__vector_pwm_on) {
+    pwmIsrMarkOn();
+    pwm_on();
+    pwmIsrMarkOff();
+}
+ISR(__vector_pwm_on_fast) {
+    pwmIsrMarkOn();
+    pwm_on_fast();
+    pwmIsrMarkOff();
+}
+ISR(__vector_pwm_on_fast_high) {
+    pwmIsrMarkOn();
+    pwm_on_fast_high();
+    pwmIsrMarkOff();
+}
+ISR(__vector_pwm_on_high) {
+    pwmIsrMarkOn();
+    pwm_on_high();
+    pwmIsrMarkOff();
+}
+
+ISR(TIMER2_OVF_vect, ISR_NAKED) {
+    asm volatile(
+	"push r30\n\t"
+	"push r31\n\t"
+	"lds r30, %[status]\n\t"
+	"ldi r31, hi8(pm(pwm_nop_entry))\n\t"
+	"ijmp\n\t"
+	:: [status] "i" (&PWM_STATUS));
+}
+#else
 ISR(TIMER2_OVF_vect) {
+    pwmIsrMarkOn();
     switch(PWM_STATUS) {
     case PWM_OFF:
 	pwm_off();
@@ -59,4 +316,6 @@ ISR(TIMER2_OVF_vect) {
     case PWM_NOP:
 	break;
     }
+    pwmIsrMarkOff();
 }
+#endif
@@ -1,6 +1,7 @@
 
 
 #include "globals.h"
+#include "atmel.h"
 #include <avr/interrupt.h>
 
 #ifndef INTERRUPTS_H
@@ -15,29 +16,35 @@
 // http://www.nongnu.org/avr-libc/user-manual/group__util__atomic.html#gaaaea265b31dabcfb3098bec7685c39e4
 
 
+// TCNT1 and tcnt1x as 24 bits, call with interrupts disabled.
+inline ticks24_t getTCNT1x() {
+    const uint16_t tcnt1 = getTCNT1();
+    return extendTCNT1(tcnt1, tcnt1x, getTIFR());
+}
+
 /************************************/
 /* Timer2 Interrpts: PWM Interrupts */
 /************************************/
 
 inline void setPwmToOn() {
-    PWM_STATUS = PWM_ON;
+    PWM_STATUS = pwm_status(PWM_ON);
 }
 
 // Equivelent setting ZL to pwm_wdr: in simonk, but we aren't yet using a watchdog.
 inline void setPwmToNop() {
-    PWM_STATUS = PWM_NOP;
+    PWM_STATUS = pwm_status(PWM_NOP);
 }
 
 inline void setPwmToOff() {
-    PWM_STATUS = PWM_OFF;
+    PWM_STATUS = pwm_status(PWM_OFF);
 }
 
 inline bool isPwmSetToNop() {
-    return PWM_STATUS == PWM_NOP;
+    return PWM_STATUS == pwm_status(PWM_NOP);
 }
 
 inline bool isPwmSetToOff() {
-    return PWM_STATUS == PWM_OFF;
+    return PWM_STATUS == pwm_status(PWM_OFF);
 }
 
 // Actual PWM interrupt bodies.
@@ -68,47 +75,77 @@ inline bool isPwmSetToOff() {
 /* ; is longer than will fit in 8 bits. This is tracked in tcnt2h.	     */
 /*****************************************************************************/
 
-inline void pwm_a_on() {
-    if (HIGH_SIDE_PWM) {
-	ApFetOn();
-    } else {
-	AnFetOn();
+////////////////////////////////////////////////////////////////////////
+// The PWM FETs all sit on PWM_PORT, so each PWM edge is one out of a  //
+// value the commutation step precomputed, pwm_port_on/pwm_port_off,  //
+// with no per phase tests and no read-modify-write.		      //
+// Anything else that changes PWM_PORT while the PWM runs has to	      //
+// resync them, with interrupts disabled, or the next edge undoes it.  //
+// Every edge writes all of PORTD on the afro_nfet, that is, besides   //
+// the nFETs on PD3-PD5:					      //
+//   PD0/PD1, RXD/TXD. The USART owns TXD while TXEN is set, and RXD   //
+//     is an input, so only its pull-up bit is rewritten.	      //
+//   PD2, ApFET. Switched by the commutations, which resync.	      //
+//   PD6/PD7, AIN0/AIN1. Inputs, only their pull-up bits, off.	      //
+////////////////////////////////////////////////////////////////////////
+static_assert(!HIGH_SIDE_PWM, "High side PWM FETs span two ports, one out per edge won't do.");
+
+inline uint8_t pwm_fet_bit() {
+    return pwm_port_on ^ pwm_port_off;
+}
+
+// Take every pin but the PWM FET from PWM_PORT as it is now.
+// A complementary pFET on PWM_PORT stays off in both images, the PWM edges switch it.
+inline void sync_pwm_port() {
+    const uint8_t pwm_bit = pwm_fet_bit();
+    uint8_t off = PWM_PORT & ~pwm_bit;
+    if (COMP_PWM) {
+	off |= pFetPwmPortBit(comp_fet);
     }
-}
-inline void pwm_b_on() {
-    if (HIGH_SIDE_PWM) {
-	BpFetOn();
-    } else {
-	BnFetOn();
+    pwm_port_off = off;
+    pwm_port_on = off | pwm_bit;
+}
+
+// Move the PWM to the FET at new_bit, switched on now only if the old one was on.
+inline void move_pwm_fet(const uint8_t new_bit) {
+    const uint8_t old_bit = pwm_fet_bit();
+    const uint8_t port = PWM_PORT;
+    const uint8_t off = port & ~old_bit & ~new_bit;
+    pwm_port_off = off;
+    pwm_port_on = off | new_bit;
+    PWM_PORT = (port & old_bit) ? pwm_port_on : pwm_port_off;
+}
+
+////////////////////////////////////////////////////////////////////////
+// COMP_PWM: the pFET of the PWM phase, comp_fet, carries the current  //
+// in the off period instead of the nFET's body diode. Each edge	      //
+// switches one FET of the pair off, waits DEAD_TIME_CYCLES, and only  //
+// then switches the other on, so the pair never conducts together.    //
+// Commutations clear comp_fet before moving the PWM FET, see	      //
+// pwm_focus_off() in commutations.h.				      //
+////////////////////////////////////////////////////////////////////////
+
+// Before the PWM FET switches on.
+inline void comp_pwm_fet_off() {
+    if (!COMP_PWM) {
+	return;
     }
-}
-inline void pwm_c_on() {
-    if (HIGH_SIDE_PWM) {
-	CpFetOn();
-    } else {
-	CnFetOn();
+    const uint8_t phase = comp_fet;
+    if (phase != PHASE_NONE) {
+	pFetOff(phase);
+	delayCycles<DEAD_TIME_CYCLES>();
     }
 }
 
-inline void pwm_a_off() {
-    if (HIGH_SIDE_PWM) {
-	ApFetOff();
-    } else {
-	AnFetOff();
-    }
-}
-inline void pwm_b_off() {
-    if (HIGH_SIDE_PWM) {
-	BpFetOff();
-    } else {
-	BnFetOff();
+// After the PWM FET switches off.
+inline void comp_pwm_fet_on() {
+    if (!COMP_PWM) {
+	return;
     }
-}
-inline void pwm_c_off() {
-    if (HIGH_SIDE_PWM) {
-	CpFetOff();
-    } else {
-	CnFetOff();
+    const uint8_t phase = comp_fet;
+    if (phase != PHASE_NONE) {
+	delayCycles<DEAD_TIME_CYCLES>();
+	pFetOn(phase);
     }
 }
 
@@ -133,22 +170,14 @@ inline void pwm_again() {
 }
 
 inline void pwm_on_fast() {
-    if (a_fet) {
-	pwm_a_on();
-    }
-    if (b_fet) {
-	pwm_b_on();
-    }
-
-    if (c_fet) {
-	pwm_c_on();
-    }
+    comp_pwm_fet_off();
+    PWM_PORT = pwm_port_on;
     setPwmToOff();
     // Now reset the '16' bit timer2 to duty
     // H is the high byte
     tcnt2h = ((0xFF00u & duty) >> 8);
     // L is the low byte.
-    TCNT2 = (0xFFu & duty);
+    setTCNT2(0xFFu & duty);
     return;
 }
 
@@ -171,22 +200,35 @@ inline void pwm_off() {
 
     // Turn fets off now.
     // Offset by a few cycles, but should be equal on time.
-    if (a_fet) {
-	pwm_a_off();
-    }
-    if (b_fet) {
-	pwm_b_off();
-    }
-    if (c_fet) {
-	pwm_c_off();
-    }
-    TCNT2 = (off_duty & 0xFF);
+    PWM_PORT = pwm_port_off;
+    setTCNT2(off_duty & 0xFF);
     // Only COMP_PWM stuff beyond this point!
+    comp_pwm_fet_on();
     return;
 }
 
 
+// TIMER2_COMPARE_PWM handlers, the timer itself handles the period,
+// so there is nothing to reload here.
 
+// Timer2 overflow, start of the period.
+inline void pwm_compare_on() {
+    // PWM_ON_PTR is PWM_OFF when the duty is 0, in which case we never switch on.
+    if (isPwmSetToNop() || PWM_ON_PTR == pwm_status(PWM_OFF)) {
+	return;
+    }
+    comp_pwm_fet_off();
+    PWM_PORT = pwm_port_on;
+}
+
+// Timer2 compare match, OCR2 ticks into the period.
+inline void pwm_compare_off() {
+    if (isPwmSetToNop() || full_power) {
+	return;
+    }
+    PWM_PORT = pwm_port_off;
+    comp_pwm_fet_on();
+}
 
 // Disable PWM interrupts and turn off all FETS.
 inline void switchPowerOff() {
@@ -202,6 +244,9 @@ inline void switchPowerOff() {
     AnFetOff();
     BnFetOff();
     CnFetOff();
+    comp_fet = PHASE_NONE;
+    // Keep the PWM FET for when the PWM restarts.
+    sync_pwm_port();
 }
 
 #endif
@@ -1,14 +1,14 @@
 #include "ocr1a.h"
 #include "globals.h"
 #include "byte_manipulation.h"
+#include "atmel.h"
 
 
 void set_ocr1a_abs_fast(const uint16_t y) {
-    const uint8_t ocf1a_mask = getByteWithBitSet(OCF1A);
     cli();
-    OCR1A = y;
-    TIFR = ocf1a_mask; // Clear any pending OCF1A interrupt.
-    const uint16_t tcnt1_in = TCNT1;
+    setOCR1A(y);
+    clearPendingOcf1a(); // Clear any pending OCF1A interrupt.
+    const uint16_t tcnt1_in = getTCNT1();
     oct1_pending = true;
     ocr1ax = 0x00U;
     sei();
@@ -35,49 +35,41 @@ void set_ocr1a_abs_fast(const uint16_t y) {
 // Potential bug source, this function is REALLY tricky!
 // Wait, are we sure that tcnt1x and co should be unsigned actually?
 // I might need to look into signed/unsigned subtraction...
-void set_ocr1a_abs_slow(const uint32_t new_timing) {
-    const uint8_t original_timsk = TIMSK;
+BENCH_NOINLINE void set_ocr1a_abs_slow(const ticks24_t new_timing) {
+    const uint8_t original_timsk = getTIMSK();
     // Temp. disable TOIE1 and OCIE1A
-    TIMSK = TIMSK & getByteWithBitCleared(TOIE1) & getByteWithBitCleared(OCIE1A);
-    const uint8_t ocf1a_mask = getByteWithBitSet(OCF1A);
+    setTIMSK(original_timsk & getByteWithBitCleared(TOIE1) & getByteWithBitCleared(OCIE1A));
     cli();
-    OCR1A = 0x0000FFFFu & new_timing;
-    TIFR = ocf1a_mask; // Clear any pending OCF1A interrupts.
-    const uint16_t tcnt1_in = TCNT1;
+    setOCR1A(new_timing.low16());
+    clearPendingOcf1a(); // Clear any pending OCF1A interrupts.
+    const uint16_t tcnt1_in = getTCNT1();
     sei();
     oct1_pending = true;
 
-    uint8_t tcnt1x_copy = tcnt1x;
-    const uint8_t tifr_orig = TIFR;
+    const uint8_t tcnt1x_copy = tcnt1x;
+    const uint8_t tifr_orig = getTIFR();
 
-    // Question: I can't figure out what the point of cpi temp2, 0x80 is here, so I gave up.
-    // OH, it sets the fucking carry for the following possibly adc instruction!!!!!
-    const bool carry = (((tcnt1_in) >> 8 & 0x00FFu) < 0x80u);
-    if ( carry && ((tifr_orig & getByteWithBitSet(TOV1)) != 0x00U)) {
-	++tcnt1x_copy;
-    }
-
-    // Lots of tricky 8bit->24bit->32bit conversion here, hopefully nothing is bugged, or too slow.
-    const uint32_t tcnt1_combined = ((uint32_t)tcnt1x_copy << 16) | (uint32_t)tcnt1_in;
+    // SimonK's cpi temp2, 0x80 sets the carry for the adc onto tcnt1x, see extendTCNT1.
+    const ticks24_t tcnt1_combined = extendTCNT1(tcnt1_in, tcnt1x_copy, tifr_orig);
 
     // TODO: Wrap in sei/cli?
-    ocr1ax = (((new_timing - tcnt1_combined) & 0xFF000000u) >> 16) & 0x000000FFu;
+    // Compare matches to skip before new_timing: the third byte of the time left.
+    ocr1ax = (new_timing - tcnt1_combined).byte3();
 
     if (new_timing >= tcnt1_combined) {
-	TIMSK = original_timsk;
+	setTIMSK(original_timsk);
 	return;
     }
     oct1_pending = false;
-    TIMSK = original_timsk;
+    setTIMSK(original_timsk);
     return;
 }
 
 void set_ocr1a_zct_slow() {
     // Loads 24 bits of com_time into y/tmp7, and 24 bits of timing into temp1-3.
-    uint32_t y = com_timing;
+    ticks24_t y = com_timing;
     y += timing;
     y += timing;
-    y &= 0xFFFFFF;
     set_ocr1a_abs_slow(y);
     return;
 }
@@ -85,9 +77,9 @@ void set_ocr1a_zct_slow() {
 // Should his be returning the new com time perhaps?
 void set_ocr1a_zct() {
     if ( slow_cpu && timing_fast ) {
-        uint16_t y = com_timing;
-        y += timing;
-        y += timing;
+        uint16_t y = com_timing.low16();
+        y += timing.low16();
+        y += timing.low16();
 	set_ocr1a_abs_fast(y);
     } else {
 	set_ocr1a_zct_slow();
@@ -109,19 +101,16 @@ void set_ocr1a_rel(uint16_t Y, const uint8_t temp7) {
     // Leave for now, as we want to load OCF1A into the register first anyway, although I don't think the compiler
     // needs to respect that wish, so might need to get tweaked anyway based on code generated.
     // TLDR; I'll need to comback to this.
-    const uint8_t ocf1a_bitmask = getByteWithBitSet(OCF1A); // A
     cli(); // B
-    Y+=TCNT1; // C // Registers 0xF7/ and 0xFF?
-    OCR1A = Y; // D
-    TIFR = ocf1a_bitmask; // clear any pending interrupts, ideally, this should be 7 cycles from the earlier TCNT1 read.
+    Y+=getTCNT1(); // C // Registers 0xF7/ and 0xFF?
+    setOCR1A(Y); // D
+    clearPendingOcf1a(); // clear any pending interrupts, ideally, this should be 7 cycles from the earlier TCNT1 read.
     ocr1ax = temp7; // E
     oct1_pending = true; // F
     sei(); // G
     return;
 }
 
-void set_ocr1a_rel(const uint32_t timing) {
-    const uint8_t upper = (timing >> 16) & 0xFFu;
-    const uint16_t lower = (timing & 0xFFFFu);
-    set_ocr1a_rel(lower, upper);
+void set_ocr1a_rel(const ticks24_t timing) {
+    set_ocr1a_rel(timing.low16(), timing.byte3());
 }
@@ -1,12 +1,24 @@
 #include "globals.h"
+#include "atmel.h"
+#include "set_duty.h"
 
 #ifndef OCR1A_H
 #define OCR1A_H
 
 inline void wait_OCT1_tot() {
     do {
-	// Potentially eval_rc, if the EVAL_RC flag is set.
-	// if (eval_rc) { evaluate_rc(); }
+	eval_rc_if_pending();
+	if (COMMUTATE_IN_ISR) {
+	    cli();
+	    // The input ISR wakes the sleep to post a throttle, go round and apply it.
+	    if (oct1_pending && !eval_rc) {
+		sleepIdleUntilInterrupt();
+	    } else {
+		sei();
+	    }
+	} else {
+	    busyWaitPoll();
+	}
     } while(oct1_pending); // Wait for commutation_time,
     // an interrupt will eventually flip this, t1oca_int:.
 }
@@ -14,8 +26,8 @@ inline void wait_OCT1_tot() {
 
 
 void set_ocr1a_abs_fast(const uint16_t y);
-void set_ocr1a_abs_slow(const uint32_t new_timing);
+void set_ocr1a_abs_slow(const ticks24_t new_timing);
 void set_ocr1a_zct();
-void set_ocr1a_rel(const uint32_t timing);
+void set_ocr1a_rel(const ticks24_t timing);
 void set_ocr1a_rel(uint16_t Y, const uint8_t temp7);
 #endif
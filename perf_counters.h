@@ -0,0 +1,63 @@
+#include <stdint.h>
+#include "esc_config.h"
+#include "ticks24.h"
+
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+////////////////////////////////////////////////////////////////////////////////////////
+// Event counters, PERF_COUNTERS in esc_config.h. One byte each, saturating at 255,   //
+// and only counted in branches that are already off the commutation's fast path.     //
+// They count since power up, except the shortest timing, which is per run (reset by //
+// start_from_running()). Read them with a debugger, in the UART_TELEMETRY counters   //
+// frame, or after the status bytes of a TWI_SLAVE read.			      //
+////////////////////////////////////////////////////////////////////////////////////////
+struct PerfCounters {
+    uint8_t demag_timeouts;
+    uint8_t zc_timeouts; // wait_timeout_run().
+    uint8_t startup_timeouts; // No zero crossing while starting.
+    uint8_t power_skips; // Commutations with the power off.
+    uint8_t timing_max_clamps;
+    uint8_t governor_clamps;
+    uint8_t starts; // start_from_running().
+    uint8_t start_failures;
+};
+// The counters, then the shortest timing this run as 3 bytes, low byte first.
+constexpr inline uint8_t PERF_COUNTER_BYTES = sizeof(PerfCounters) + 3;
+
+inline PerfCounters perf_counters;
+// The shortest timing this run, so the maximum eRPM is timing_to_erpm() of it. 0xFFFFFF
+// until the motor is running. Kept raw, the divide is up to whoever reads it.
+inline ticks24_t perf_min_timing = ticks24_t::wrap(0xFFFFFFul);
+
+inline void perf_count(uint8_t& counter) {
+    if (PERF_COUNTERS && counter != 0xFFu) {
+	++counter;
+    }
+}
+
+inline void perf_start_run() {
+    perf_count(perf_counters.starts);
+    perf_min_timing = ticks24_t::wrap(0xFFFFFFul);
+}
+
+// Once per electrical revolution, from run(): a 24 bit compare, and a store for a new
+// fastest timing.
+inline void perf_track_timing(const ticks24_t timing) {
+    if (PERF_COUNTERS && timing < perf_min_timing) {
+	perf_min_timing = timing;
+    }
+}
+
+// PERF_COUNTER_BYTES into out, for the serial and bus readouts.
+inline void perf_serialize(uint8_t* out) {
+    const uint8_t* const counters = reinterpret_cast<const uint8_t*>(&perf_counters);
+    for (uint8_t i = 0; i < sizeof(PerfCounters); ++i) {
+	out[i] = counters[i];
+    }
+    const ticks24_t min_timing = perf_min_timing;
+    out[sizeof(PerfCounters)] = min_timing.low16();
+    out[sizeof(PerfCounters) + 1] = min_timing.low16() >> 8;
+    out[sizeof(PerfCounters) + 2] = min_timing.byte3();
+}
+#endif
@@ -1,26 +1,51 @@
 #include "set_duty.h"
 #include "globals.h"
 #include "byte_manipulation.h"
+#include "atmel.h"
+#include "twi.h"
+#include "governor.h"
 
 
+// TIMER2_COMPARE_PWM: Scale the on duty, out of POWER_RANGE, to the 256 tick Timer2 period.
+// Multiply and keep the high word rather than divide, this runs on every zero crossing.
+constexpr inline uint32_t TIMER2_COMPARE_SCALE = 0x10000ul * 0x100u / POWER_RANGE;
+uint8_t timer2_compare_duty(const uint16_t on_duty) {
+    const uint16_t compare = (on_duty * TIMER2_COMPARE_SCALE) >> 16;
+    if (compare > 0xFFu) {
+	return 0xFFu;
+    }
+    // A compare of 0 matches together with the overflow, and the compare interrupt has the
+    // higher priority, so the FETs would be switched off before they're switched on.
+    if (compare == 0) {
+	return 1;
+    }
+    return compare;
+}
+
 // rc_duty_copy = yl/yh, new_duty = temp1/2.
 void set_new_duty_21(uint16_t rc_duty_copy, uint16_t new_duty, const PWM_STATUS_ENUM next_pwm_status) {
     // set_new_duty21:
+    // Only the on duty matters to TIMER2_COMPARE_PWM, the period is fixed by the timer.
+    const uint8_t compare = TIMER2_COMPARE_PWM ? timer2_compare_duty(rc_duty_copy) : 0;
     new_duty = (new_duty & 0xFF00u) | ((uint8_t)~get_low(new_duty));
     rc_duty_copy = (rc_duty_copy & 0xFF00u) | ((uint8_t)~get_low(rc_duty_copy));
     cli();
+    if (TIMER2_COMPARE_PWM) {
+	// With PWM_ON_PTR, so both ISRs see the same step's duty.
+	setPwmCompare(compare);
+    }
     // Duty is set atomically in the ASM, but not promised here!
     duty = rc_duty_copy;
     // These must be set atomically!
     off_duty = new_duty;
-    PWM_ON_PTR = next_pwm_status;
+    PWM_ON_PTR = pwm_status(next_pwm_status);
     // End set atomically!
     sei();
     return;
 }
 
 // rc_duty_copy = yl/yh.
-void set_new_duty_l(uint16_t rc_duty_copy) {
+BENCH_NOINLINE void set_new_duty_l(uint16_t rc_duty_copy) {
     if ( timing_duty <= rc_duty_copy ) {
 	rc_duty_copy = timing_duty;
     }
@@ -70,7 +95,8 @@ void set_new_duty_l(uint16_t rc_duty_copy) {
     // At higher PWM frequencies, halve the frequency
     // when starting -- this helps hard drive startup
 
-    if (POWER_RANGE < (1700 * (cpu_mhz / 16.0))){ // 1700 is a torukmakto4 change
+    // Not with TIMER2_COMPARE_PWM, where the period is fixed by the timer.
+    if (!TIMER2_COMPARE_PWM && POWER_RANGE < (1700 * (cpu_mhz / 16.0))){ // 1700 is a torukmakto4 change
 	if (startup) {
 	    new_duty = new_duty << 1;
 	    rc_duty_copy = rc_duty_copy << 1;
@@ -98,7 +124,16 @@ void set_new_duty() {
 // Sets the speed that the ESC will try to rev to!
 // Takes PARAM in YL/YH.
 // Set YL/YH to MAX_POWER for full power, or 0 for off.
+// RPM_GOVERNOR: a throttle while running only sets the target, governor_update() owns
+// rc_duty.
 void rc_duty_set(uint16_t new_rc_duty) {
+    if (RPM_GOVERNOR) {
+	governor_set_target(new_rc_duty);
+	if (set_duty && new_rc_duty != 0) {
+	    rc_timeout = RCP_TOT;
+	    return;
+	}
+    }
     rc_duty = new_rc_duty;
     if (set_duty) {
 	rc_timeout = RCP_TOT;
@@ -111,3 +146,101 @@ void rc_duty_set(uint16_t new_rc_duty) {
 	return;
     }
 }
+
+// RC_PULS: A protocol's pulse lengths in Timer1 ticks, and its duty per tick above stop
+// as a 16.16 multiplier, so the scaling keeps the capture's 1/16us resolution without a
+// divide.
+struct RcPulsRange {
+    uint16_t min_ticks; // Shorter is not a valid pulse.
+    uint16_t stop_ticks; // Zero throttle at and below.
+    uint16_t range_ticks; // Stop to full throttle.
+    uint16_t max_ticks; // Longer is not a valid pulse.
+    uint32_t scale;
+};
+
+constexpr RcPulsRange rc_puls_range(const uint16_t min_us, const uint16_t stop_us,
+				    const uint16_t full_us, const uint16_t max_us) {
+    const uint16_t range_ticks = (full_us - stop_us) * cpu_mhz;
+    return RcPulsRange{
+	static_cast<uint16_t>(min_us * cpu_mhz),
+	static_cast<uint16_t>(stop_us * cpu_mhz),
+	range_ticks,
+	static_cast<uint16_t>(max_us * cpu_mhz),
+	static_cast<uint32_t>(0x10000ul * MAX_POWER / range_ticks),
+    };
+}
+
+// The valid lengths of the protocols don't overlap, so any one pulse tells them apart.
+constexpr RcPulsRange rc_puls_range(const RcProtocol protocol) {
+    switch (protocol) {
+    case RC_PROTOCOL_ONESHOT125:
+	return rc_puls_range(104U, 125U, 250U, 320U);
+    case RC_PROTOCOL_ONESHOT42:
+	return rc_puls_range(34U, 42U, 84U, 100U);
+    case RC_PROTOCOL_MULTISHOT:
+	return rc_puls_range(3U, 5U, 25U, 32U);
+    default:
+	return rc_puls_range(MIN_RC_PULS, STOP_RC_PULS, FULL_RC_PULS, MAX_RC_PULS);
+    }
+}
+
+// rc_protocol's.
+RcPulsRange rc_puls_active = rc_puls_range(RC_PROTOCOL_PWM);
+
+uint16_t rc_puls_duty(const uint16_t puls_ticks) {
+    if (puls_ticks <= rc_puls_active.stop_ticks) {
+	return 0;
+    }
+    const uint16_t above_stop = puls_ticks - rc_puls_active.stop_ticks;
+    if (above_stop >= rc_puls_active.range_ticks) {
+	return MAX_POWER;
+    }
+    return (above_stop * rc_puls_active.scale) >> 16;
+}
+
+// While arming: let TIMER1_CAPT_vect post the pulses of every protocol.
+void open_rc_protocol_detection() {
+    cli();
+    rc_puls_min_ticks = rc_puls_range(RC_PROTOCOL_MULTISHOT).min_ticks;
+    rc_puls_max_ticks = rc_puls_range(RC_PROTOCOL_PWM).max_ticks;
+    sei();
+}
+
+// While arming: switch to the protocol of this pulse. Restarts the count of good pulses
+// (rc_timeout) on a switch. Returns false for a pulse no protocol accepts.
+bool detect_rc_protocol(const uint16_t puls_ticks) {
+    for (uint8_t protocol = 0; protocol < RC_PROTOCOL_COUNT; ++protocol) {
+	const RcPulsRange range = rc_puls_range(static_cast<RcProtocol>(protocol));
+	if (puls_ticks < range.min_ticks || puls_ticks > range.max_ticks) {
+	    continue;
+	}
+	if (protocol != rc_protocol) {
+	    rc_protocol = static_cast<RcProtocol>(protocol);
+	    rc_puls_active = range;
+	    rc_timeout = 0;
+	}
+	return true;
+    }
+    return false;
+}
+
+// Once started: only the detected protocol's pulses are valid, so a glitch can't pass
+// for another protocol's throttle.
+void lock_rc_protocol() {
+    cli();
+    rc_puls_min_ticks = rc_puls_active.min_ticks;
+    rc_puls_max_ticks = rc_puls_active.max_ticks;
+    sei();
+}
+
+// SimonK's evaluate_rc: apply the throttle an input ISR posted.
+void evaluate_rc() {
+    cli();
+    eval_rc = false;
+    const uint16_t posted = RC_PULS ? posted_rc_puls : TWI_SLAVE ? posted_twi_throttle : posted_rc_duty;
+    sei();
+    if (RC_PULS && !set_duty && !detect_rc_protocol(posted)) {
+	return;
+    }
+    rc_duty_set(RC_PULS ? rc_puls_duty(posted) : TWI_SLAVE ? twi_duty(posted) : posted);
+}
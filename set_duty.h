@@ -1,4 +1,5 @@
 #include <stdint.h>
+#include "globals.h"
 #ifndef SET_DUTY_H
 #define SET_DUTY_H
 
@@ -6,4 +7,35 @@ void set_new_duty_l(uint16_t rc_duty_copy);
 void set_new_duty_set(uint16_t rc_duty_copy, uint16_t new_duty);
 void set_new_duty();
 void rc_duty_set(uint16_t new_rc_duty);
+uint16_t rc_puls_duty(uint16_t puls_ticks);
+void open_rc_protocol_detection();
+bool detect_rc_protocol(uint16_t puls_ticks);
+void lock_rc_protocol();
+void evaluate_rc();
+
+// From an input ISR: a new throttle for rc_duty_set(), 0 to MAX_POWER.
+// The wait loops apply it on their next pass, see eval_rc_if_pending().
+inline void post_rc_duty(const uint16_t rc_duty_in) {
+    posted_rc_duty = rc_duty_in;
+    eval_rc = true;
+}
+
+// RC_PULS: the same for a pulse length in Timer1 ticks, evaluate_rc() scales it.
+inline void post_rc_puls(const uint16_t puls_ticks) {
+    posted_rc_puls = puls_ticks;
+    eval_rc = true;
+}
+
+// TWI_SLAVE: the same for an 11 bit throttle, evaluate_rc() scales it.
+inline void post_twi_throttle(const uint16_t throttle) {
+    posted_twi_throttle = throttle;
+    eval_rc = true;
+}
+
+// Called on every pass of the wait loops, so only a flag test without a new throttle.
+inline void eval_rc_if_pending() {
+    if (eval_rc) {
+	evaluate_rc();
+    }
+}
 #endif
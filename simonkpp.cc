@@ -14,6 +14,8 @@
 #include "wait_functions.h"
 #include "set_duty.h"
 #include "control.h"
+#include "twi.h"
+#include "telemetry.h"
 
 // REMEMBER: VARIABLES BEING set/access from an interrupt must be volatile!
 // Big TODO: Move into proper .cc/.h files, and INLINE the world. I can use -Winline to make not inlining a warning.
@@ -47,9 +49,15 @@ int main() {
 	greenLedOff();
 	_delay_ms(1000);
     }
+    if (TWI_SLAVE) {
+	initTwiSlave();
+    }
+    if (UART_TELEMETRY) {
+	init_telemetry();
+    }
     while (true) {
 	enableTimerInterrupts();
 	sei();
-	restart_control();
+	control_loop();
     }
 }
@@ -0,0 +1,37 @@
+#include "stack.h"
+#include <avr/io.h>
+
+#ifdef HOST_SIM
+// The host build runs on the host's stack, nothing to measure.
+void update_stack_watermark() {}
+#else
+extern uint8_t _end; // Linker: the end of .bss and .noinit.
+extern uint8_t __stack; // Linker: the top of the stack, RAMEND.
+
+// Runs from .init3, after the startup code set SP, before main() or any constructor.
+// Naked, so no frame: Z walks from _end up to __stack.
+extern "C" void paint_stack() __attribute__((naked, used, section(".init3")));
+void paint_stack() {
+    asm volatile(
+	"ldi r30, lo8(_end)\n\t"
+	"ldi r31, hi8(_end)\n\t"
+	"ldi r24, %[paint]\n\t"
+	"ldi r25, hi8(__stack)\n\t"
+	"rjmp 2f\n"
+	"1:\n\t"
+	"st Z+, r24\n"
+	"2:\n\t"
+	"cpi r30, lo8(__stack)\n\t"
+	"cpc r31, r25\n\t"
+	"brlo 1b\n\t"
+	:: [paint] "i" (STACK_PAINT));
+}
+
+void update_stack_watermark() {
+    const uint8_t* p = &_end;
+    while (p <= &__stack && *p == STACK_PAINT) {
+	++p;
+    }
+    stack_high_watermark = &__stack + 1 - p;
+}
+#endif
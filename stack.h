@@ -0,0 +1,20 @@
+#include <stdint.h>
+
+#ifndef STACK_H
+#define STACK_H
+
+////////////////////////////////////////////////////////////////////////
+// Stack high watermark. The startup code paints the SRAM between the  //
+// end of .bss and the top of the stack with STACK_PAINT, so the	      //
+// lowest byte since overwritten marks the deepest the stack has been. //
+// The ATmega8 has 1KB of SRAM for the globals and the stack together. //
+////////////////////////////////////////////////////////////////////////
+constexpr inline uint8_t STACK_PAINT = 0xC5u;
+
+// Most stack used so far in bytes, as of the last update_stack_watermark().
+inline uint16_t stack_high_watermark = 0;
+
+// Scans the painted SRAM a byte at a time, about 8 cycles a byte, so several thousand
+// cycles while most of it is still painted. Only call it with the motor off.
+void update_stack_watermark();
+#endif
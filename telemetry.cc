@@ -0,0 +1,84 @@
+#include "telemetry.h"
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "globals.h"
+#include "atmel.h"
+#include "control.h"
+#include "perf_counters.h"
+
+// U2X halves the divider, so 115200 baud is 2.1% off at 16MHz instead of 3.5%.
+constexpr inline uint16_t TELEMETRY_UBRR = (cpu_mhz * 1000000ul / 8 + TELEMETRY_BAUD / 2) / TELEMETRY_BAUD - 1;
+
+// Transmit only, TXD (PD1) is already an output. The receiver stays off, so RXD is free.
+void init_telemetry() {
+    UBRRH = TELEMETRY_UBRR >> 8;
+    UBRRL = TELEMETRY_UBRR;
+    UCSRA = getByteWithBitSet(U2X);
+    UCSRC = getByteWithBitSet(URSEL) | getByteWithBitSet(UCSZ1) | getByteWithBitSet(UCSZ0); // 8N1
+    UCSRB = getByteWithBitSet(TXEN);
+}
+
+// Queues sync, body and the XOR of the body, or drops the lot if it doesn't fit.
+void queue_telemetry_frame(const uint8_t sync, const uint8_t* body, const uint8_t length) {
+    uint8_t head = telemetry_head;
+    const uint8_t free = (telemetry_tail - head - 1) & (TELEMETRY_BUFFER_BYTES - 1);
+    if (free < length + 2) {
+	return;
+    }
+    telemetry_buffer[head] = sync;
+    head = (head + 1) & (TELEMETRY_BUFFER_BYTES - 1);
+    uint8_t check = 0;
+    for (uint8_t i = 0; i < length; ++i) {
+	telemetry_buffer[head] = body[i];
+	head = (head + 1) & (TELEMETRY_BUFFER_BYTES - 1);
+	check ^= body[i];
+    }
+    telemetry_buffer[head] = check;
+    head = (head + 1) & (TELEMETRY_BUFFER_BYTES - 1);
+    cli();
+    telemetry_head = head;
+    UCSRB = UCSRB | getByteWithBitSet(UDRIE);
+    sei();
+}
+
+void send_telemetry_if_due() {
+    if (!telemetry_due) {
+	return;
+    }
+    telemetry_due = false;
+    ++telemetry_frame_count;
+    if (PERF_COUNTERS && (telemetry_frame_count & (TELEMETRY_COUNTERS_PERIOD - 1)) == 0) {
+	uint8_t counters[PERF_COUNTER_BYTES];
+	perf_serialize(counters);
+	queue_telemetry_frame(TELEMETRY_COUNTERS_SYNC, counters, sizeof(counters));
+	return;
+    }
+    // Raw, like perf_serialize(), the receiver does the timing_to_erpm() divide.
+    const ticks24_t frame_timing = control_state == CONTROL_RUNNING ? timing : ticks24_t();
+    const uint8_t frame[TELEMETRY_FRAME_BYTES - 2] = {
+	control_state,
+	goodies,
+	(uint8_t) frame_timing.low16(),
+	(uint8_t) (frame_timing.low16() >> 8),
+	frame_timing.byte3(),
+	(uint8_t) sys_control,
+	(uint8_t) (sys_control >> 8),
+	(uint8_t) timing_duty,
+	(uint8_t) (timing_duty >> 8),
+    };
+    queue_telemetry_frame(TELEMETRY_SYNC, frame, sizeof(frame));
+}
+
+void send_telemetry_byte(const uint8_t byte) {
+    const uint8_t head = telemetry_head;
+    const uint8_t next = (head + 1) & (TELEMETRY_BUFFER_BYTES - 1);
+    while (next == telemetry_tail) {
+	busyWaitPoll();
+    }
+    telemetry_buffer[head] = byte;
+    cli();
+    telemetry_head = next;
+    UCSRB = UCSRB | getByteWithBitSet(UDRIE);
+    sei();
+}
@@ -0,0 +1,42 @@
+#include <stdint.h>
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+////////////////////////////////////////////////////////////////////////////////////////
+// UART telemetry, UART_TELEMETRY in esc_config.h. Every TELEMETRY_PERIOD_OVERFLOWS   //
+// Timer1 overflows, TIMER1_OVF_vect sets telemetry_due, and the next		      //
+// send_telemetry_if_due() outside the commutation waits queues a frame for	      //
+// USART_UDRE_vect to send. A frame that doesn't fit in the ring buffer is dropped,   //
+// nothing ever waits for the USART.						      //
+// 										      //
+// Frame, 8N1 at TELEMETRY_BAUD, multi byte fields low byte first:		      //
+//   0xA5, control state, goodies, timing (3 bytes, 0 unless running), sys_control   //
+//   (2), timing_duty (2), and the XOR of the bytes after the 0xA5. The eRPM is	      //
+//   timing_to_erpm() (update_timing.h) of timing, left to the receiver.	      //
+// With PERF_COUNTERS, every TELEMETRY_COUNTERS_PERIOD'th frame is the counters	      //
+// instead: 0xC3, perf_serialize() (perf_counters.h), and the XOR.		      //
+////////////////////////////////////////////////////////////////////////////////////////
+constexpr inline uint8_t TELEMETRY_SYNC = 0xA5u;
+constexpr inline uint8_t TELEMETRY_FRAME_BYTES = 11;
+constexpr inline uint8_t TELEMETRY_COUNTERS_SYNC = 0xC3u;
+// A power of two, about once a second.
+constexpr inline uint8_t TELEMETRY_COUNTERS_PERIOD = 64;
+// 4096us each, so 61 frames a second.
+constexpr inline uint8_t TELEMETRY_PERIOD_OVERFLOWS = 4;
+// A power of two, at least one frame.
+constexpr inline uint8_t TELEMETRY_BUFFER_BYTES = 32;
+static_assert((TELEMETRY_BUFFER_BYTES & (TELEMETRY_BUFFER_BYTES - 1)) == 0, "TELEMETRY_BUFFER_BYTES is a power of two");
+
+// The ring buffer. telemetry_head is only written by the foreground, telemetry_tail only
+// by USART_UDRE_vect.
+inline uint8_t telemetry_buffer[TELEMETRY_BUFFER_BYTES];
+inline volatile uint8_t telemetry_head = 0;
+inline volatile uint8_t telemetry_tail = 0;
+inline uint8_t telemetry_frame_count = 0;
+
+void init_telemetry();
+void send_telemetry_if_due();
+// Queues one byte, waiting for room. Only where the motor is off, see freeze_trace().
+void send_telemetry_byte(uint8_t byte);
+#endif
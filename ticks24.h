@@ -0,0 +1,72 @@
+#include <stdint.h>
+
+#ifndef TICKS24_H
+#define TICKS24_H
+
+////////////////////////////////////////////////////////////////////////////////////////
+// Timer1 time in 24 bits: TCNT1 extended by tcnt1x, SimonK's _l/_h/_x register	      //
+// triples (timing, com_time, last_tcnt1, ...).					      //
+// avr-gcc has a native 3 byte __uint24, so adds, subtracts, shifts and compares are   //
+// 3 byte ops instead of 4 plus a 0xFFFFFF mask. The host build has no __uint24 and   //
+// masks a uint32_t instead. Either way every operation wraps at 2^24, like the	      //
+// extended timer does.								      //
+////////////////////////////////////////////////////////////////////////////////////////
+
+#ifdef __AVR__
+typedef __uint24 raw_ticks24_t;
+#else
+typedef uint32_t raw_ticks24_t;
+#endif
+
+class ticks24_t {
+public:
+    constexpr ticks24_t() : value(0) {}
+    // TCNT1 (or OCR1A) and its third byte.
+    constexpr ticks24_t(const uint16_t low, const uint8_t x)
+	: value(((raw_ticks24_t) x << 16) | low) {}
+
+    // The low 24 bits of a constant or a wider intermediate.
+    static constexpr ticks24_t wrap(const uint32_t in) {
+	return ticks24_t(wrapped(in));
+    }
+
+    constexpr uint16_t low16() const { return value; }
+    // Bits 8-23, SimonK's _h/_x pair.
+    constexpr uint16_t high16() const { return value >> 8; }
+    constexpr uint8_t byte3() const { return value >> 16; }
+    constexpr uint32_t widen() const { return value; }
+
+    constexpr ticks24_t operator+(const ticks24_t other) const {
+	return ticks24_t(wrapped(value + other.value));
+    }
+    constexpr ticks24_t operator-(const ticks24_t other) const {
+	return ticks24_t(wrapped(value - other.value));
+    }
+    constexpr ticks24_t operator>>(const uint8_t shift) const {
+	return ticks24_t(value >> shift);
+    }
+    ticks24_t& operator+=(const ticks24_t other) { return *this = *this + other; }
+    ticks24_t& operator-=(const ticks24_t other) { return *this = *this - other; }
+
+    constexpr bool operator==(const ticks24_t other) const { return value == other.value; }
+    constexpr bool operator!=(const ticks24_t other) const { return value != other.value; }
+    constexpr bool operator<(const ticks24_t other) const { return value < other.value; }
+    constexpr bool operator>(const ticks24_t other) const { return value > other.value; }
+    constexpr bool operator<=(const ticks24_t other) const { return value <= other.value; }
+    constexpr bool operator>=(const ticks24_t other) const { return value >= other.value; }
+
+private:
+    explicit constexpr ticks24_t(const raw_ticks24_t raw) : value(raw) {}
+
+    static constexpr raw_ticks24_t wrapped(const uint32_t raw) {
+#ifdef __AVR__
+	return raw; // Narrowing to __uint24 is the wrap.
+#else
+	return raw & 0xFFFFFFu;
+#endif
+    }
+
+    raw_ticks24_t value;
+};
+
+#endif
@@ -12,19 +12,21 @@
 // returns via y/7.
 // Messing around here:
 // https://pastebin.com/xW8fGFz5
-uint32_t update_timing_add_degrees(uint32_t local_timing,
-				   uint32_t local_com_time,
-				   uint8_t degree /* temp4 */) {
-
-   local_com_time += get_high(degree * get_low(local_timing));
-   local_com_time += degree * get_high(local_timing);
-   // TODO: Removing this uint32_t changes the behavior of this function?! Why?
-   local_com_time += (((uint32_t)degree) * ((uint32_t)get_byte3(local_timing))) << 8;
-   return local_com_time & 0xFFFFFFu;
+// The products are widened by hand: degree * a byte doesn't fit a 16 bit signed int.
+BENCH_NOINLINE ticks24_t update_timing_add_degrees(const ticks24_t local_timing,
+						   ticks24_t local_com_time,
+						   const uint8_t degree /* temp4 */) {
+   const uint16_t low_product = (uint16_t) degree * get_low(local_timing.low16());
+   const uint16_t high_product = (uint16_t) degree * get_high(local_timing.low16());
+   const uint16_t x_product = (uint16_t) degree * local_timing.byte3();
+   local_com_time += ticks24_t(get_high(low_product), 0);
+   local_com_time += ticks24_t(high_product, 0);
+   local_com_time += ticks24_t(x_product << 8, get_high(x_product));
+   return local_com_time;
 }
 
 
-uint32_t set_timing_degrees_slow(const uint8_t degree /* temp4 */) {
+ticks24_t set_timing_degrees_slow(const uint8_t degree /* temp4 */) {
     // Loads 24 bits of com_time into y/tmp7, and 24 bits of timing into temp1-3.
     return update_timing_add_degrees(timing, com_timing, degree);
 
@@ -38,14 +40,14 @@ void set_timing_degrees(const uint8_t degree /* temp4 */) {
 	// I'm probably seeing the forest for the trees.
 	// TODO(bregg): Look at this again.
 	const uint16_t timing_low_degree_product =
-	    ((uint16_t)get_low(timing)) * ((uint16_t)degree);
+	    ((uint16_t)get_low(timing.low16())) * ((uint16_t)degree);
 	const uint16_t timing_high_degree_product =
-	    ((uint16_t)get_high(timing)) * ((uint16_t)degree);
-	uint16_t new_com_timing = (com_timing & 0xFFFFu) + get_high(timing_low_degree_product);
+	    ((uint16_t)get_high(timing.low16())) * ((uint16_t)degree);
+	uint16_t new_com_timing = com_timing.low16() + get_high(timing_low_degree_product);
 	new_com_timing += timing_high_degree_product;
 	set_ocr1a_abs_fast(new_com_timing);
     } else {
-	uint32_t new_timing = set_timing_degrees_slow(degree);
+	const ticks24_t new_timing = set_timing_degrees_slow(degree);
 	set_ocr1a_abs_slow(new_timing);
     }
 
@@ -1,10 +1,13 @@
+#include <stdint.h>
+#include "ticks24.h"
+
 #ifndef TIMING_DEGREES_H
 #define TIMING_DEGREES_H
 
 void set_timing_degrees(const uint8_t degree /* temp4 */);
-uint32_t set_timing_degrees_slow(const uint8_t degree /* temp4 */);
-uint32_t update_timing_add_degrees(uint32_t local_timing,
-				   uint32_t local_com_time,
-				   uint8_t degree /* temp4 */);
+ticks24_t set_timing_degrees_slow(const uint8_t degree /* temp4 */);
+ticks24_t update_timing_add_degrees(const ticks24_t local_timing,
+				    ticks24_t local_com_time,
+				    const uint8_t degree /* temp4 */);
 
 #endif
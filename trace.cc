@@ -0,0 +1,29 @@
+#include "trace.h"
+
+#include "telemetry.h"
+
+void freeze_trace() {
+    trace_frozen = true;
+    if (!UART_TELEMETRY) {
+	return;
+    }
+    send_telemetry_byte(TRACE_SYNC);
+    send_telemetry_byte(TRACE_RECORDS);
+    uint8_t check = TRACE_RECORDS;
+    uint8_t index = trace_next;
+    do {
+	const TraceRecord& record = trace_records[index];
+	const uint8_t bytes[sizeof(TraceRecord)] = {
+	    (uint8_t) record.delta,
+	    (uint8_t) (record.delta >> 8),
+	    record.events,
+	    record.goodies,
+	};
+	for (const uint8_t byte : bytes) {
+	    send_telemetry_byte(byte);
+	    check ^= byte;
+	}
+	index = (index + 1) & (TRACE_RECORDS - 1);
+    } while (index != trace_next);
+    send_telemetry_byte(check);
+}
@@ -0,0 +1,72 @@
+#include <stdint.h>
+#include "esc_config.h"
+#include "globals.h"
+
+#ifndef TRACE_H
+#define TRACE_H
+
+////////////////////////////////////////////////////////////////////////////////////////
+// Commutation trace, COMMUTATION_TRACE in esc_config.h. wait_commutation() records   //
+// every zero crossing into a ring of TRACE_RECORDS, overwriting the oldest, with the  //
+// events since the one before. When run() gives up (!power_on && goodies == 0) the   //
+// trace is frozen, so the commutations leading up to it stay in trace_records for a  //
+// debugger, and, with UART_TELEMETRY, dumped on TXD:				      //
+//   0x5A, TRACE_RECORDS, the records oldest first (4 bytes each, delta low byte      //
+//   first), and the XOR of the bytes after the 0x5A.				      //
+// Recording thaws at the next start.						      //
+////////////////////////////////////////////////////////////////////////////////////////
+constexpr inline uint8_t TRACE_SYNC = 0x5Au;
+// A power of two, 4 bytes each.
+constexpr inline uint8_t TRACE_RECORDS = 64;
+static_assert((TRACE_RECORDS & (TRACE_RECORDS - 1)) == 0, "TRACE_RECORDS is a power of two");
+
+// TraceRecord::events.
+constexpr inline uint8_t TRACE_TIMING_FAST = 0x01u; // update_timing4() took the 16 bit OCR1A path.
+constexpr inline uint8_t TRACE_DEMAG_TIMEOUT = 0x02u;
+constexpr inline uint8_t TRACE_ZC_TIMEOUT = 0x04u;
+constexpr inline uint8_t TRACE_TIMING_MAX = 0x08u; // sys_control halved at TIMING_MAX.
+constexpr inline uint8_t TRACE_GOVERNOR = 0x10u; // sys_control halved at the safety governor.
+constexpr inline uint8_t TRACE_POWER_SKIP = 0x20u; // Commutated without power.
+
+struct TraceRecord {
+    uint16_t delta; // Timer1 ticks since the last zero crossing, 0xFFFF past 16 bits.
+    uint8_t events;
+    uint8_t goodies;
+};
+
+inline TraceRecord trace_records[TRACE_RECORDS];
+inline uint8_t trace_next = 0;
+inline uint8_t trace_events = 0; // Since the last record.
+inline bool trace_frozen = false;
+
+inline void trace_event(const uint8_t event) {
+    if (COMMUTATION_TRACE) {
+	trace_events |= event;
+    }
+}
+
+// From wait_commutation(), after update_timing() moved this zero crossing into
+// last_tcnt1.
+inline void trace_commutation() {
+    if (!COMMUTATION_TRACE || trace_frozen) {
+	return;
+    }
+    const ticks24_t delta = last_tcnt1 - last2_tcnt1;
+    TraceRecord& record = trace_records[trace_next];
+    record.delta = delta.byte3() == 0 ? delta.low16() : 0xFFFFu;
+    record.events = trace_events | (timing_fast ? TRACE_TIMING_FAST : 0)
+	| (power_skip != 0 ? TRACE_POWER_SKIP : 0);
+    record.goodies = goodies;
+    trace_events = 0;
+    trace_next = (trace_next + 1) & (TRACE_RECORDS - 1);
+}
+
+// Stop recording, and dump the trace with UART_TELEMETRY. Waits for the USART, so only
+// with the motor off.
+void freeze_trace();
+
+inline void thaw_trace() {
+    trace_frozen = false;
+    trace_events = 0;
+}
+#endif
@@ -0,0 +1,139 @@
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "esc_config.h"
+#include "globals.h"
+#include "atmel.h"
+#include "control.h"
+#include "set_duty.h"
+#include "perf_counters.h"
+
+#ifndef TWI_H
+#define TWI_H
+
+////////////////////////////////////////////////////////////////////////////////////////
+// MikroKopter style I2C throttle, TWI_SLAVE in esc_config.h.			      //
+// Each ESC answers at its own address, 0x52 + 2 * (TWI_MOTOR_ID - 1) as an 8 bit     //
+// write address, so one bus carries up to 8 ESCs.				      //
+// Writes: one byte is an 8 bit throttle (BL-Ctrl 1), a second byte adds the low 3    //
+// bits of an 11 bit one (BL-Ctrl 2). The throttle is posted at the STOP, or repeated //
+// START, and scaled by evaluate_rc().						      //
+// Reads: TWI_STATUS_BYTES of status, see twi_load_status(), then with PERF_COUNTERS  //
+// the counters, see perf_serialize().						      //
+// 										      //
+// TWI_vect masks itself and reenables interrupts straight after its prologue, so     //
+// TIMER2_OVF_vect only ever waits for that. The bus is held (SCL low) until the      //
+// handler writes TWINT back.							      //
+////////////////////////////////////////////////////////////////////////////////////////
+
+static_assert(TWI_MOTOR_ID >= 1 && TWI_MOTOR_ID <= 8, "TWI_MOTOR_ID is 1 to 8");
+constexpr inline uint8_t TWI_ADDRESS = 0x52u + 2u * (TWI_MOTOR_ID - 1u);
+constexpr inline uint16_t TWI_FULL_THROTTLE = 0xFFu << 3; // 8 bit 255.
+// Duty per 11 bit throttle step, 16.16, so there's no divide per write.
+constexpr inline uint32_t TWI_SCALE = 0x10000ul * MAX_POWER / TWI_FULL_THROTTLE;
+
+// TWSR, prescaler bits masked, in slave mode.
+enum TwiStatus : uint8_t {
+    TWI_BUS_ERROR = 0x00u,
+    TWI_SLA_W = 0x60u, // Own address and write received, ACKed.
+    TWI_GENERAL_CALL = 0x70u,
+    TWI_DATA_RECEIVED = 0x80u, // ACKed.
+    TWI_GENERAL_CALL_DATA = 0x90u,
+    TWI_STOP = 0xA0u, // Or repeated START.
+    TWI_SLA_R = 0xA8u, // Own address and read received, ACKed.
+    TWI_DATA_SENT_ACK = 0xB8u, // The master wants another byte.
+    TWI_DATA_SENT_NACK = 0xC0u,
+    TWI_LAST_DATA_SENT = 0xC8u,
+};
+
+// Status byte 0: the ControlState in the low bits, then flags.
+constexpr inline uint8_t TWI_STATUS_POWER_ON = 0x20u;
+constexpr inline uint8_t TWI_STATUS_REVERSE = 0x40u;
+constexpr inline uint8_t TWI_STATUS_NO_SIGNAL = 0x80u; // rc_timeout ran out.
+// Status, goodies, then timing low byte first.
+constexpr inline uint8_t TWI_STATUS_BYTES = 5;
+constexpr inline uint8_t TWI_TX_BYTES = TWI_STATUS_BYTES + (PERF_COUNTERS ? PERF_COUNTER_BYTES : 0);
+
+// TWI_vect only.
+inline uint8_t twi_rx_count = 0;
+inline uint16_t twi_throttle = 0;
+inline uint8_t twi_tx[TWI_TX_BYTES];
+inline uint8_t twi_tx_count = 0;
+
+// Listen at TWI_ADDRESS, ACK our address, interrupt on every bus event.
+constexpr inline uint8_t TWI_LISTEN = getByteWithBitSet(TWINT) | getByteWithBitSet(TWEA)
+    | getByteWithBitSet(TWEN) | getByteWithBitSet(TWIE);
+// TWI_vect masked, TWINT left set, so the bus stays held.
+constexpr inline uint8_t TWI_HOLD = getByteWithBitSet(TWEA) | getByteWithBitSet(TWEN);
+
+inline void initTwiSlave() {
+    TWAR = TWI_ADDRESS; // General calls (TWGCE) ignored.
+    TWCR = TWI_LISTEN;
+}
+
+constexpr uint16_t twi_duty(const uint16_t throttle) {
+    return throttle >= TWI_FULL_THROTTLE ? MAX_POWER : (throttle * TWI_SCALE) >> 16;
+}
+
+// At the master's SLA+R. timing is not read atomically against update_timing(), nor
+// perf_min_timing against run(), a master wanting exact values reads twice.
+inline void twi_load_status() {
+    uint8_t status = control_state;
+    if (power_on) {
+	status |= TWI_STATUS_POWER_ON;
+    }
+    if (motor_reverse) {
+	status |= TWI_STATUS_REVERSE;
+    }
+    if (rc_timeout == 0) {
+	status |= TWI_STATUS_NO_SIGNAL;
+    }
+    twi_tx[0] = status;
+    twi_tx[1] = goodies;
+    const ticks24_t timing_copy = timing;
+    twi_tx[2] = timing_copy.low16();
+    twi_tx[3] = timing_copy.low16() >> 8;
+    twi_tx[4] = timing_copy.byte3();
+    if constexpr (PERF_COUNTERS) {
+	perf_serialize(&twi_tx[TWI_STATUS_BYTES]);
+    }
+    twi_tx_count = 0;
+}
+
+// One bus event, with interrupts on. Returns the TWCR to release the bus with.
+inline uint8_t twi_slave_event(const uint8_t twsr) {
+    switch (twsr) {
+    case TWI_SLA_W:
+	twi_rx_count = 0;
+	break;
+    case TWI_DATA_RECEIVED:
+	if (twi_rx_count == 0) {
+	    twi_throttle = (uint16_t) TWDR << 3;
+	} else if (twi_rx_count == 1) {
+	    twi_throttle |= TWDR & 0x07u;
+	}
+	++twi_rx_count;
+	break;
+    case TWI_STOP:
+	if (twi_rx_count != 0) {
+	    twi_rx_count = 0;
+	    post_twi_throttle(twi_throttle);
+	}
+	break;
+    case TWI_SLA_R:
+	twi_load_status();
+	[[fallthrough]];
+    case TWI_DATA_SENT_ACK:
+	TWDR = twi_tx_count < TWI_TX_BYTES ? twi_tx[twi_tx_count++] : 0xFFu;
+	break;
+    case TWI_BUS_ERROR:
+	// Release the lines and go back to listening.
+	return TWI_LISTEN | getByteWithBitSet(TWSTO);
+    default:
+	// General calls, and the end of a read.
+	break;
+    }
+    return TWI_LISTEN;
+}
+
+#endif
@@ -1,41 +1,30 @@
 #include "update_timing.h"
 
+#include <avr/pgmspace.h>
 #include "globals.h"
 #include "byte_manipulation.h"
+#include "atmel.h"
 #include "timing_degrees.h"
 #include "ocr1a.h"
 #include "set_duty.h"
+#include "trace.h"
+#include "perf_counters.h"
+#include "duty_limit.h"
 
 
 // Time for the dragon: UPDATE TIMING.
-void update_timing() {
-    cli(); // Disable interrupts
-    // LOADING TIME:
-    // Load TCNT1L -> temp1.
-    // Load TCNT1H into temp2
-    // Load tcnt1x -> temp3.
-    // Load TIFR into temp4
-    uint16_t tcnt1_copy = TCNT1;
-    uint8_t tcnt1x_copy = tcnt1x;
-    uint8_t tifr_copy = TIFR;
-    // We've loaded our values without worrying about interrupts,
-    // now re-enable interrupts.
-    sei();
-    // Is TCNT1h set? Then tcnt1x is right, no need to increment.
-    // Otherwise, if TOV1 was/is pending, increment our copy of tcnt1x.
-    if ( 0x80u > get_high(tcnt1_copy) && ((tifr_copy & TOV1) != 0x00u)) {
-	++tcnt1x_copy;
-    }
+// tcnt1_and_x is the Timer1 time of this zero crossing, see wait_commutation().
+BENCH_NOINLINE void update_timing(const ticks24_t tcnt1_and_x) {
     // Calculate the timing from the last two zero_crossings.
     // Yl/h/temp7 is now last_tcnt1.
     //
     // Take a copy of last_tcnt1 before we clobber it.
-    const uint32_t last_tcnt1_copy = last_tcnt1;
+    const ticks24_t last_tcnt1_copy = last_tcnt1;
     // Clobber our original last_tcnt1.
-    last_tcnt1 = (((uint32_t)tcnt1x_copy) << 16) | (tcnt1_copy);
+    last_tcnt1 = tcnt1_and_x;
 
     // temp5/6/4 is now last2_tcnt1.
-    const uint32_t last2_tcnt1_copy = last2_tcnt1;
+    const ticks24_t last2_tcnt1_copy = last2_tcnt1;
     // Clobber our original last2_tcnt1 with our original last_tcnt1.
     last2_tcnt1 = last_tcnt1_copy;
 
@@ -53,22 +42,25 @@ void update_timing() {
     ////////////////////////////////////////////////////////////////////////////
 
     // TLDR: Subtract our full 24bit copy of tcnt1x/TCNT1H/TCNT1L - last2_tcnt1_copy.
-    uint32_t tcnt1_and_x_copy =  ((((uint32_t)tcnt1x_copy) << 16) | (tcnt1_copy)) - last2_tcnt1_copy;
-    tcnt1_and_x_copy &= 0xFFFFFF;
+    ticks24_t tcnt1_and_x_copy = tcnt1_and_x - last2_tcnt1_copy;
 
-    if ( tcnt1_and_x_copy < (TIMING_MAX * cpu_mhz/2) ) {
+    if ( tcnt1_and_x_copy < ticks24_t::wrap(TIMING_MAX * cpu_mhz/2) ) {
 	// We've reached timing_max, divide sys_control by 2 and go to update_timing1.
-	tcnt1_and_x_copy = (TIMING_MAX * cpu_mhz/2);
+	tcnt1_and_x_copy = ticks24_t::wrap(TIMING_MAX * cpu_mhz/2);
 	sys_control /= 2;
+	trace_event(TRACE_TIMING_MAX);
+	perf_count(perf_counters.timing_max_clamps);
 	update_timing1(tcnt1_and_x_copy, last_tcnt1_copy);
 	return;
     }
     // Otherwise repeat the above check with our governor.
     // service_governor:
-    if ( tcnt1_and_x_copy < safety_governor  ) {
+    if ( tcnt1_and_x_copy < ticks24_t::wrap(safety_governor)  ) {
 	// We've reached out safety governer, divide sys_control by 2 and go to update_timing1.
-	tcnt1_and_x_copy = safety_governor;
+	tcnt1_and_x_copy = ticks24_t::wrap(safety_governor);
 	sys_control /= 2;
+	trace_event(TRACE_GOVERNOR);
+	perf_count(perf_counters.governor_clamps);
     }
     update_timing1(tcnt1_and_x_copy, last_tcnt1_copy);
     return;
@@ -84,28 +76,95 @@ void update_timing() {
 // ; with a (very slow) software divide only if timing permits.		  //
 ////////////////////////////////////////////////////////////////////////////
 
+////////////////////////////////////////////////////////////////////////////
+// Commutation delay after the zero crossing, in 256ths of half of timing   //
+// (60 electrical degrees), for update_timing_add_degrees(). MOTOR_ADVANCE  //
+// fixed, or with ADVANCE_CURVE, one flash byte per 256 Timer1 ticks of	  //
+// timing, from ADVANCE_CURVE_POINTS. Timing past the table's 32K ticks	  //
+// (below ~9800 eRPM) takes its last entry.				  //
+////////////////////////////////////////////////////////////////////////////
+constexpr inline uint8_t FIXED_ADVANCE_DELAY = (30 - MOTOR_ADVANCE) * 256 / 60.0;
+constexpr inline uint8_t ADVANCE_TABLE_ENTRIES = 128;
+
+constexpr uint8_t advance_to_delay(const uint32_t advance_x256) {
+    // (30 - advance) * 256 / 60, rounded, advance in 256ths of a degree.
+    return ((30ul * 256 - advance_x256) * 256 / 60 + 128) / 256;
+}
+
+// The curve at erpm, in 256ths of a degree.
+constexpr uint32_t advance_at(const uint32_t erpm) {
+    constexpr uint8_t points = sizeof(ADVANCE_CURVE_POINTS) / sizeof(ADVANCE_CURVE_POINTS[0]);
+    if (erpm <= ADVANCE_CURVE_POINTS[0].erpm) {
+	return ADVANCE_CURVE_POINTS[0].advance * 256ul;
+    }
+    for (uint8_t i = 1; i < points; ++i) {
+	const AdvancePoint low = ADVANCE_CURVE_POINTS[i - 1];
+	const AdvancePoint high = ADVANCE_CURVE_POINTS[i];
+	if (erpm <= high.erpm) {
+	    const int64_t rise = ((int64_t) high.advance - low.advance) * 256;
+	    return low.advance * 256l + rise * (int64_t) (erpm - low.erpm) / (int64_t) (high.erpm - low.erpm);
+	}
+    }
+    return ADVANCE_CURVE_POINTS[points - 1].advance * 256ul;
+}
+
+constexpr bool advance_curve_valid() {
+    constexpr uint8_t points = sizeof(ADVANCE_CURVE_POINTS) / sizeof(ADVANCE_CURVE_POINTS[0]);
+    for (uint8_t i = 0; i < points; ++i) {
+	if (ADVANCE_CURVE_POINTS[i].advance > 30
+	    || (i != 0 && ADVANCE_CURVE_POINTS[i].erpm <= ADVANCE_CURVE_POINTS[i - 1].erpm)) {
+	    return false;
+	}
+    }
+    return true;
+}
+static_assert(advance_curve_valid(), "ADVANCE_CURVE_POINTS: advance 0 - 30, eRPM ascending.");
+
+struct AdvanceTable {
+    uint8_t delays[ADVANCE_TABLE_ENTRIES];
+};
+
+// Entry i covers timing of i * 256 to i * 256 + 255 ticks, evaluated at its middle.
+constexpr AdvanceTable make_advance_table() {
+    AdvanceTable table{};
+    for (uint16_t i = 0; i < ADVANCE_TABLE_ENTRIES; ++i) {
+	table.delays[i] = advance_to_delay(advance_at(timing_to_erpm(ticks24_t(i * 256u + 128u, 0))));
+    }
+    return table;
+}
+
+const AdvanceTable advance_table PROGMEM = make_advance_table();
+
+inline uint8_t advance_delay(const ticks24_t timing) {
+    if (!ADVANCE_CURVE) {
+	return FIXED_ADVANCE_DELAY;
+    }
+    const uint16_t index = timing.high16();
+    return pgm_read_byte(&advance_table.delays[index < ADVANCE_TABLE_ENTRIES ? index : ADVANCE_TABLE_ENTRIES - 1]);
+}
+
 // Current Timing_period = temp1/2/3.
 // Last_tcnt1_copy = yl/yh/temp7.
 // xl/xh new_duty
-void update_timing4(uint16_t new_duty, uint32_t current_timing_period, uint32_t unused) {
-    current_timing_period &= 0xFFFFFF;
+void update_timing4(uint16_t new_duty, ticks24_t current_timing_period, ticks24_t unused) {
     timing_duty = new_duty;
     // Set timing_l/h/x.
     timing = current_timing_period;
+    const uint8_t delay = advance_delay(current_timing_period);
 
     current_timing_period = current_timing_period >> 1;
 
-    uint32_t last_tcnt1_copy = last_tcnt1;
+    const ticks24_t last_tcnt1_copy = last_tcnt1;
     // This clobbers registers y/7.
     // Get and then store the start of the next commutation.
     com_timing = update_timing_add_degrees(current_timing_period,
 						    last_tcnt1_copy,
-						    (30 - MOTOR_ADVANCE) * 256 / 60.0);
+						    delay);
 
     // Will 240 fit in 15 bits?
-    if ( 0x0010 > ((current_timing_period >> 8) & 0xFFFF))  {
+    if ( 0x0010 > current_timing_period.high16())  {
 	timing_fast = true;
-	set_ocr1a_abs_fast(com_timing); // Set timer for the next commutation
+	set_ocr1a_abs_fast(com_timing.low16()); // Set timer for the next commutation
     } else  {
 	timing_fast = false;
 	set_ocr1a_abs_slow(com_timing);
@@ -119,73 +178,15 @@ void update_timing4(uint16_t new_duty, uint32_t current_timing_period, uint32_t
 
 // Current Timing_period = temp1/2/3.
 // Last_tcnt1_copy = yl/yh/temp7.
-void update_timing1(const uint32_t current_timing_period, const uint32_t last_tcnt1_copy) {
+BENCH_NOINLINE void update_timing1(const ticks24_t current_timing_period, const ticks24_t last_tcnt1_copy) {
     // XL/XH = MAX_POWER
     uint16_t new_duty = MAX_POWER;
-    if ( SLOW_CPU && ((current_timing_period >> 8) & 0x00FFFF) < (TIMING_RANGE3 * cpu_mhz/2)) {
+    static_assert(SLOW_CPU, "low_speed_duty_limit() takes no timing below DUTY_LIMIT_MIN_TIMING.");
+    if ( SLOW_CPU && current_timing_period < DUTY_LIMIT_MIN_TIMING) {
 	update_timing4(new_duty, current_timing_period, last_tcnt1_copy);  // Fast timing: no duty limit
 	return;
     }
-    // TODO: Look into this more, after all this is quite tricky!!
-    // Hope this division works!!!!
-    // Implement simple fixed point division.
-    // new_duty = MAX_POWER * (TIMING_RANGE3 * cpu_mhz/2)/  current_timing_period);;
-
-    uint32_t undivided_value = (MAX_POWER * (TIMING_RANGE3 * cpu_mhz / 2) / 256.0);
-    uint8_t counter = 33;
-    bool carry = false;
-    uint32_t temp456 = 0x00u;;
-    // Is this shift going to set the carry?
-    carry = undivided_value & 0x800000u;
-    undivided_value = undivided_value << 1;
-    undivided_value &= 0xFFFFFF;
-    --counter;
-    do {
-	// We don't use this carry.
-	// bool carry_next = temp456 & 0x800000u;
-	temp456 = temp456 << 1;
-	temp456 &= 0xFFFFFF;
-	if (carry) {
-	    ++temp456;
-	    temp456 &= 0xFFFFFF;
-	}
-	// We don't use this carry.
-	// carry = carry_next;
-
-	carry = current_timing_period > temp456;
-	if ( ! carry ) {
-	    // Set what the carry will be from subtraction here.
-	    if ( current_timing_period > temp456 ) {
-		carry = true;
-	    }
-	    // subtraction here.
-	    temp456-=current_timing_period;
-	    temp456 &= 0xFFFFFF;
-	}
-	// Is our shift about to set the carry?
-	bool carry_next = undivided_value & 0x800000u;
-	undivided_value = undivided_value << 1;
-	undivided_value &= 0xFFFFFF;
-	// If we went into this with the OG carry set, add the carry on now.
-	if ( carry ) {
-	    ++undivided_value;
-	    undivided_value &= 0xFFFFFF;
-	}
-	// Now set the carry to if our shift would have set it.
-	carry = carry_next;
-	// This finished rolling xl/xh/timing_duty_l.
-	--counter;
-    } while(counter != 0);
-
-    // DONE DIVISION!
-    // Ones complement the output.
-    new_duty = ~undivided_value;
-    new_duty = new_duty & 0x0000FFFFu;
-
-    if ( PWR_MAX_RPM1 > new_duty ) {
-	new_duty = PWR_MAX_RPM1;
-    }
-
+    new_duty = low_speed_duty_limit(current_timing_period);
     update_timing4(new_duty, current_timing_period, last_tcnt1_copy);
     return;
 }
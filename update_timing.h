@@ -1,9 +1,17 @@
 #include <stdint.h>
+#include "esc_config.h"
+#include "ticks24.h"
 
 #ifndef UPDATE_TIMING_H
 #define UPDATE_TIMING_H
 
-void update_timing1(const uint32_t current_timing_period, const uint32_t last_tcnt1_copy);
+// Electrical RPM from timing, two of the six commutations of an electrical revolution
+// in Timer1 ticks. A 32 bit divide.
+constexpr uint32_t timing_to_erpm(const ticks24_t timing) {
+    return timing.widen() == 0 ? 0 : 60ul * cpu_mhz * 1000000ul / 3 / timing.widen();
+}
 
-void update_timing();
+void update_timing1(const ticks24_t current_timing_period, const ticks24_t last_tcnt1_copy);
+
+void update_timing(const ticks24_t tcnt1_and_x);
 #endif
@@ -7,11 +7,19 @@
 #include "interrupts.h"
 #include "update_timing.h"
 #include "commutations.h"
+#include "set_duty.h"
+#include "trace.h"
+#include "perf_counters.h"
 
 void demag_timeout() {
     setPwmToNop(); // Stop PWM switching, interrupts will not turn on any fets now!
+    // COMP_PWM: the complementary pFET too, or it brakes the motor through the power skip.
+    pwm_focus_off(comp_fet);
     pwm_all_off();
     redLedOn();
+    markDemagTimeout();
+    perf_count(perf_counters.demag_timeouts);
+    trace_event(TRACE_DEMAG_TIMEOUT);
     // Skip power for the next commutation. Note that this
     // won't decrease a non-zero powerskip because demag
     // checking is skipped when powerskip is non-zero.
@@ -20,15 +28,82 @@ void demag_timeout() {
     return;
 }
 
+#if ZC_INTERRUPT || ZC_CAPTURE
+//////////////////////////////////////////////////////////////////////////
+// ZC_INTERRUPT: instead of sampling ACO on every pass, the wait loops   //
+// arm ANA_COMP_vect for the edge into the level wait_for_edge2() counts //
+// down on, and only sample once it fired. The ISR timestamps the edge,  //
+// which becomes the zero crossing time handed to update_timing(), so   //
+// neither the filter nor PWM interrupts landing in the loop delay it.  //
+// ZC_CAPTURE: TIMER1_CAPT_vect takes the timestamp from ICR1 instead,  //
+// and stays armed, so a later edge replaces an earlier, rejected one.  //
+//////////////////////////////////////////////////////////////////////////
+
+// The ACO level wait_for_edge2() counts down on.
+inline bool zc_level() {
+    return aco_edge_high != HIGH_SIDE_PWM;
+}
+
+inline void disarm_zc_edge() {
+    if (ZC_CAPTURE) {
+	disarmCaptureInterrupt();
+    } else {
+	disarmComparatorInterrupt();
+    }
+}
+
+// Wait for the next edge into zc_level(), or take now if ACO is already there.
+void arm_zc_edge() {
+    const bool level = zc_level();
+    cli();
+    zc_edge_pending = false;
+    if (ZC_CAPTURE) {
+	armCaptureInterrupt(level);
+    } else {
+	armComparatorInterrupt(level);
+    }
+    if (isAcoSet() == level) {
+	if (!ZC_CAPTURE) {
+	    disarmComparatorInterrupt();
+	}
+	zc_tcnt1 = getTCNT1x();
+	zc_edge_pending = true;
+    }
+    sei();
+}
+
+// Disarm, and the zero crossing time: the edge if there was one, else now.
+ticks24_t take_zc_time() {
+    disarm_zc_edge();
+    cli();
+    const ticks24_t zc_time = zc_edge_pending ? zc_tcnt1 : getTCNT1x();
+    sei();
+    return zc_time;
+}
+#endif
+
 void wait_for_demag() {
+#if ZC_INTERRUPT
+    arm_zc_edge();
+    while (!zc_edge_pending) {
+	if (!oct1_pending) {
+	    disarm_zc_edge();
+	    demag_timeout();
+	    return;
+	}
+	eval_rc_if_pending();
+    }
+    wait_for_edge0();
+    return;
+#endif
     do {
 	// If we don't have an oct1_pending, go to demag_timeout.
 	if (!oct1_pending) {
 	    demag_timeout();
 	    return;
 	}
-	// potentially eval_rc,/set_duty here if we are doing that with our new protocol.
-    } while((aco_edge_high != (bool(ACSR & getByteWithBitSet(ACO)))) != HIGH_SIDE_PWM);  // Check for demagnetization;
+	eval_rc_if_pending();
+    } while((aco_edge_high != isAcoSet()) != HIGH_SIDE_PWM);  // Check for demagnetization;
     wait_for_edge0();
 }
 
@@ -51,7 +126,7 @@ void wait_for_edge_below_max(uint8_t quartered_timing_lower) {
 
 void wait_for_edge0() {
     // We take the two high  bytes of timing, and then left shift twice!
-    uint16_t quartered_timing =  ((timing >> 8) & 0xFFFF) >> 2;
+    uint16_t quartered_timing =  timing.high16() >> 2;
     if ( quartered_timing <  MASKED_ZC_CHECK_MIN ) {
 	wait_for_edge_fast_min();
 	return;
@@ -93,17 +168,51 @@ void wait_for_edge() {
 
 
 void wait_for_edge2(uint8_t quartered_timing_higher, uint8_t quartered_timing_lower) {
+#if ZC_INTERRUPT
+    // The same up/down filter as below, over samples taken from the edge on. A sample at the
+    // opposite level counts up once, as in the poll loop, and waits for the next edge.
+    arm_zc_edge();
+    do {
+	if (!oct1_pending) {
+	    disarm_zc_edge();
+	    wait_timeout(quartered_timing_higher,quartered_timing_lower);
+	    return;
+	}
+	eval_rc_if_pending();
+	if (!zc_edge_pending) {
+	    continue;
+	}
+	if (isAcoSet() != zc_level()) {
+	    if (quartered_timing_lower < quartered_timing_higher ) {
+		++quartered_timing_lower;
+	    }
+	    arm_zc_edge();
+	    continue;
+	}
+	--quartered_timing_lower;
+	if (quartered_timing_lower == 0) {
+	    wait_commutation(take_zc_time());
+	    return;
+	}
+    } while(true);
+#endif
+#if ZC_CAPTURE
+    arm_zc_edge();
+#endif
     bool opposite_level;
     do {
 	// If OCT1_pending, we need to go to wait_timeout.
 	if (!oct1_pending) {
+#if ZC_CAPTURE
+	    disarm_zc_edge();
+#endif
 	    wait_timeout(quartered_timing_higher,quartered_timing_lower);
 	    return;
 	}
-	// potentially eval_rc,/set_duty here if we are doing that with our new protocol.
+	eval_rc_if_pending();
 	// .if 0 ; Visualize comparator output on the flag pin.
 
-	opposite_level = (aco_edge_high != (bool(ACSR & getByteWithBitSet(ACO))));
+	opposite_level = (aco_edge_high != isAcoSet());
 
 	if (opposite_level != HIGH_SIDE_PWM) {
 	    // cp xl, xh
@@ -116,7 +225,11 @@ void wait_for_edge2(uint8_t quartered_timing_higher, uint8_t quartered_timing_lo
 	    if (quartered_timing_lower == 0) {
 		// And then finally done! Return all the way back up through
 		// wait_for_edge*
+#if ZC_CAPTURE
+		wait_commutation(take_zc_time());
+#else
 		wait_commutation();
+#endif
 		return;
 	    }
 	}
@@ -127,17 +240,17 @@ void wait_for_edge2(uint8_t quartered_timing_higher, uint8_t quartered_timing_lo
 
 void wait_startup() {
     {
-	constexpr uint32_t new_timing = START_DELAY_US * ((uint32_t) cpu_mhz);
+	constexpr ticks24_t new_timing = ticks24_t::wrap(START_DELAY_US * ((uint32_t) cpu_mhz));
 	if ( goodies >= 2 ) {
 	    const uint8_t degrees = start_delay;
-	    constexpr uint32_t start_destep_micros_clock_cycles = START_DSTEP_US * ((uint32_t) cpu_mhz) * 0x100u;
+	    constexpr ticks24_t start_destep_micros_clock_cycles = ticks24_t::wrap(START_DSTEP_US * ((uint32_t) cpu_mhz) * 0x100u);
 	    set_ocr1a_rel(update_timing_add_degrees(start_destep_micros_clock_cycles, new_timing, degrees));
 	} else {
 	    set_ocr1a_rel(new_timing);
 	}
     }
     wait_OCT1_tot();
-    constexpr uint32_t timeout_cycles = TIMEOUT_START * ((uint32_t) cpu_mhz);
+    constexpr ticks24_t timeout_cycles = ticks24_t::wrap(TIMEOUT_START * ((uint32_t) cpu_mhz));
     set_ocr1a_rel(timeout_cycles);
 
    // Powered startup: Use a fixed (long) ZC check count until goodies reaches
@@ -163,26 +276,67 @@ void wait_pwm_running() {
 
 void wait_pwm_enable() {
     if (isPwmSetToNop() ) {
+	// The PWM ISR leaves the port alone while NOP, catch up before it starts writing it.
+	cli();
+	sync_pwm_port();
 	setPwmToOff();
+	sei();
 	redLedOff();
     }
     wait_pwm_running();
 }
 
 void wait_commutation() {
+    cli();
+    const ticks24_t now = getTCNT1x();
+    sei();
+    wait_commutation(now);
+}
+
+#if COMMUTATE_IN_ISR
+// Hand the run loop's next step to TIMER1_COMPA_vect for the commutation time
+// update_timing() just set, or commutate now if that already passed.
+void schedule_commutation() {
+    const commutation_t commutation = next_commutation;
+    next_commutation = nullptr;
+    if (commutation == nullptr) {
+	return;
+    }
+    cli();
+    if (oct1_pending) {
+	scheduled_commutation = commutation;
+    } else {
+	commutation();
+    }
+    sei();
+}
+#endif
+
+void wait_commutation(const ticks24_t zc_time) {
     flagOn();
-    update_timing();
+    updateTimingMarkOn();
+    update_timing(zc_time);
+    updateTimingMarkOff();
+    trace_commutation();
     startup = false;
-    wait_OCT1_tot();
-    flagOff();
-
+    // Before the commutation, which checks power_on.
     if (power_skip != 0x00u) {
+	perf_count(perf_counters.power_skips);
 	power_on = false;
     }
+#if COMMUTATE_IN_ISR
+    // The rc_timeout check below would only see this after the ISR commutated, the run
+    // loop doesn't commutate on a rearm either.
+    if ( rc_timeout == 0x00u) {
+	next_commutation = nullptr;
+    }
+    schedule_commutation();
+#endif
+    wait_OCT1_tot();
+    flagOff();
     // On rc_timeout, immediately restart control.
     if ( rc_timeout == 0x00u) {
-	// TODO: Risk of stack overflow here eventually if we restart control enough?!
-	restart_control();
+	request_rearm();
 	return;
     }
 
@@ -192,9 +346,11 @@ void wait_commutation() {
 
 void wait_timeout_start() {
     goodies = 0x00u; // Clear good commutation count.
+    trace_event(TRACE_ZC_TIMEOUT);
 
     // Increase the start (blanking) delay unless we are running.
     if (startup) {
+	perf_count(perf_counters.startup_timeouts);
 	start_delay += START_DELAY_INC;
     }
     wait_timeout_init();
@@ -203,6 +359,7 @@ void wait_timeout_start() {
 
 void wait_timeout_run() {
     redLedOn();
+    perf_count(perf_counters.zc_timeouts);
     wait_timeout_start();
 }
 
@@ -12,7 +12,9 @@ void wait_for_edge0();
 void wait_pwm_enable();
 void wait_pwm_running();
 void wait_timeout(uint8_t quartered_timing_higher, uint8_t quartered_timing_lower);
+// Commutation timing from a zero crossing now, or at zc_time.
 void wait_commutation();
+void wait_commutation(const ticks24_t zc_time);
 
 inline void wait_for_low() {
     aco_edge_high = false;